@@ -0,0 +1,288 @@
+#!/usr/bin/python3
+
+#
+# Compiles a config into the binary cache the loader keeps beside it, so that
+# images can ship with it and the first boot doesn't need to parse the config
+# either. Has to be kept in sync with src/config/ConfigCache.h.
+#
+
+import argparse
+import ipaddress
+import os
+import struct
+import sys
+import uuid
+
+CONFIG_CACHE_MAGIC = int.from_bytes(b'RLCC', 'little')
+CONFIG_CACHE_VERSION = 5
+CONFIG_CACHE_NO_STRING = 0xFFFFFFFF
+
+BOOT_LINUX = 1
+BOOT_MB2 = 2
+BOOT_LINUX_EFI = 3
+BOOT_LIMINE = 4
+
+BOOT_ROOT_CONFIG = 0
+BOOT_ROOT_PARTITION = 1
+BOOT_ROOT_GUID = 2
+BOOT_ROOT_TFTP = 3
+
+KEYS = {
+    'TIMEOUT': 'timeout',
+    'DEFAULT_ENTRY': 'default_entry',
+    'PATH': 'path',
+    'KERNEL_PATH': 'path',
+    'CMDLINE': 'cmdline',
+    'KERNEL_CMDLINE': 'cmdline',
+    'PROTOCOL': 'protocol',
+    'KERNEL_PROTO': 'protocol',
+    'KERNEL_PROTOCOL': 'protocol',
+    'MODULE_PATH': 'module_path',
+    'MODULE_STRING': 'module_string',
+    'SHA256': 'sha256',
+    'KERNEL_SHA256': 'sha256',
+    'MODULE_SHA256': 'module_sha256',
+    'MODULES_ABOVE_4G': 'modules_above_4g',
+    'LOG_LEVEL': 'log_level',
+    'MENU_KEY': 'menu_key',
+}
+
+LOG_LEVELS = {
+    'error': 0,
+    'warn': 1,
+    'info': 2,
+}
+
+MENU_KEYS = {
+    'any': 0,
+    'shift': 1,
+    'ctrl': 2,
+    'alt': 3,
+    'none': 4,
+}
+
+
+def fnv1a(data):
+    h = 0xcbf29ce484222325
+    for b in data:
+        h = ((h ^ b) * 0x100000001b3) & 0xFFFFFFFFFFFFFFFF
+    return h
+
+
+def decode(data):
+    if data.startswith(b'\xef\xbb\xbf'):
+        text = data[3:].decode('utf-8', errors='replace')
+    elif data.startswith(b'\xff\xfe'):
+        text = data[2:].decode('utf-16-le', errors='replace')
+    else:
+        text = data.decode('utf-8', errors='replace')
+
+    # The loader only deals in UCS-2
+    return ''.join(c if ord(c) <= 0xFFFF else '�' for c in text)
+
+
+def decimal(value):
+    digits = ''
+    for c in value.lstrip(' \t'):
+        if not c.isdigit():
+            break
+        digits += c
+    return int(digits) if digits else 0
+
+
+def parse_uri(uri):
+    scheme, sep, rest = uri.partition('://')
+    if not sep:
+        sys.exit(f'Invalid uri `{uri}`')
+
+    root, sep, path = rest.partition('/')
+    if not sep:
+        sys.exit(f'Missing path in uri `{uri}`')
+    path = path.replace('/', '\\')
+
+    if scheme == 'boot':
+        if root == '':
+            return (BOOT_ROOT_CONFIG, 0, bytes(16), bytes(4)), path
+        return (BOOT_ROOT_PARTITION, decimal(root), bytes(16), bytes(4)), path
+    elif scheme in ('guid', 'uuid'):
+        return (BOOT_ROOT_GUID, 0, uuid.UUID(root).bytes_le, bytes(4)), path
+    elif scheme == 'tftp':
+        try:
+            server = ipaddress.IPv4Address(root).packed
+        except ValueError:
+            sys.exit(f'Invalid server address `{root}`')
+        return (BOOT_ROOT_TFTP, 0, bytes(16), server), path
+
+    sys.exit(f'Unsupported resource type `{scheme}`')
+
+
+def parse_sha256(value):
+    try:
+        digest = bytes.fromhex(value)
+    except ValueError:
+        digest = b''
+    if len(value) != 64 or len(digest) != 32:
+        sys.exit(f'Invalid SHA256 `{value}`')
+    return digest
+
+
+def parse(text):
+    options = {}
+    entries = []
+    entry = None
+    module_string = None
+
+    for line in text.split('\n'):
+        line = line.replace('\r', '')
+
+        if line.startswith(':'):
+            entry = {'name': line[1:], 'protocol': 0, 'path': None, 'root': None, 'cmdline': None, 'sha256': None, 'modules_above_4g': False, 'modules': []}
+            entries.append(entry)
+            module_string = None
+            continue
+
+        key, sep, value = line.partition('=')
+        if not sep or key not in KEYS:
+            continue
+        key = KEYS[key]
+
+        if entry is None:
+            if key == 'timeout':
+                if value == 'Disabled':
+                    options['timeout'] = (True, 0)
+                else:
+                    options['timeout'] = (False, decimal(value))
+            elif key == 'default_entry':
+                options['default_entry'] = decimal(value)
+            elif key == 'log_level':
+                if value not in LOG_LEVELS:
+                    sys.exit(f'Unknown log level `{value}`')
+                options['log_level'] = LOG_LEVELS[value]
+            elif key == 'menu_key':
+                if value not in MENU_KEYS:
+                    sys.exit(f'Unknown menu key `{value}`')
+                options['menu_key'] = MENU_KEYS[value]
+            continue
+
+        if key == 'path':
+            entry['root'], entry['path'] = parse_uri(value)
+        elif key == 'cmdline':
+            entry['cmdline'] = value
+        elif key == 'protocol':
+            if value == 'linux':
+                entry['protocol'] = BOOT_LINUX
+            elif value == 'mb2':
+                entry['protocol'] = BOOT_MB2
+            elif value == 'linux-efi':
+                entry['protocol'] = BOOT_LINUX_EFI
+            elif value == 'limine':
+                entry['protocol'] = BOOT_LIMINE
+            else:
+                sys.exit(f'Unknown protocol `{value}` for option `{entry["name"]}`')
+        elif key == 'module_path':
+            root, path = parse_uri(value)
+            entry['modules'].append({'root': root, 'path': path, 'tag': None, 'sha256': None})
+            if module_string is None:
+                module_string = len(entry['modules']) - 1
+        elif key == 'module_string':
+            if entry['protocol'] not in (BOOT_MB2, BOOT_LIMINE):
+                sys.exit('`MODULE_STRING` is only available for Multiboot2 and Limine')
+            if module_string is None:
+                sys.exit('MODULE_PATH must be provided before MODULE_STRING')
+            entry['modules'][module_string]['tag'] = value
+            module_string += 1
+            if module_string == len(entry['modules']):
+                module_string = None
+        elif key == 'sha256':
+            entry['sha256'] = parse_sha256(value)
+        elif key == 'module_sha256':
+            if not entry['modules']:
+                sys.exit('MODULE_PATH must be provided before MODULE_SHA256')
+            entry['modules'][-1]['sha256'] = parse_sha256(value)
+        elif key == 'modules_above_4g':
+            if entry['protocol'] != BOOT_MB2:
+                sys.exit('`MODULES_ABOVE_4G` is only available for Multiboot2')
+            if value not in ('yes', 'no'):
+                sys.exit(f'Expected `yes` or `no` for `MODULES_ABOVE_4G` of option `{entry["name"]}`')
+            entry['modules_above_4g'] = value == 'yes'
+
+    valid = [e for e in entries if e['protocol'] != 0 and e['path'] is not None]
+    return options, valid
+
+
+def build(data, options, entries):
+    strings = []
+    strings_size = 0
+
+    # Like the loader, only values that were never set are left out of the
+    # pool, an empty one still gets an offset
+    def add_string(s):
+        nonlocal strings_size
+        if s is None:
+            return CONFIG_CACHE_NO_STRING
+        offset = strings_size
+        strings.append(s + '\0')
+        strings_size += len(s) + 1
+        return offset
+
+    def pack_root(root):
+        return struct.pack('<II16s4s', *root)
+
+    def pack_sha256(digest):
+        return struct.pack('<B32s', digest is not None, digest or bytes(32))
+
+    entry_blobs = []
+    module_blobs = []
+    for e in entries:
+        entry_blobs.append(
+            struct.pack('<IIII', e['protocol'], add_string(e['name']), add_string(e['path']), add_string(e['cmdline']))
+            + pack_root(e['root'])
+            + struct.pack('<I', len(e['modules']))
+            + pack_sha256(e['sha256'])
+            + struct.pack('<B', e['modules_above_4g']))
+        for m in e['modules']:
+            module_blobs.append(
+                pack_root(m['root'])
+                + struct.pack('<II', add_string(m['path']), add_string(m['tag']))
+                + pack_sha256(m['sha256']))
+
+    disable_timer, boot_delay = options.get('timeout', (False, 0))
+    header = struct.pack(
+        '<IIQQ16sBBBBB3xiiIII',
+        CONFIG_CACHE_MAGIC,
+        CONFIG_CACHE_VERSION,
+        fnv1a(data),
+        len(data),
+        bytes(16),  # No time, the firmware would never agree with ours
+        'timeout' in options,
+        disable_timer,
+        'default_entry' in options,
+        options['log_level'] + 1 if 'log_level' in options else 0,
+        options['menu_key'] + 1 if 'menu_key' in options else 0,
+        boot_delay,
+        options.get('default_entry', 0),
+        len(entry_blobs),
+        len(module_blobs),
+        strings_size)
+
+    return header + b''.join(entry_blobs) + b''.join(module_blobs) + ''.join(strings).encode('utf-16-le')
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser("gen_config_cache")
+    parser.add_argument("config", help="The config to compile.")
+    parser.add_argument("-o", "--output", help="Where to write the cache, defaults to beside the config.")
+
+    args = parser.parse_args()
+
+    output = args.output
+    if output is None:
+        output = os.path.splitext(args.config)[0] + '.cfc'
+
+    with open(args.config, 'rb') as config_file:
+        data = config_file.read()
+
+    options, entries = parse(decode(data))
+
+    with open(output, 'wb') as output_file:
+        output_file.write(build(data, options, entries))
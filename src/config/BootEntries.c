@@ -1,25 +1,24 @@
 #include "BootEntries.h"
 #include "BootConfig.h"
+#include "ConfigCache.h"
 
 #include <util/Except.h>
 #include <util/FileUtils.h>
+#include <util/MenuKey.h>
 
 #include <Uefi.h>
 
 #include <Library/BaseMemoryLib.h>
 #include <Library/DebugLib.h>
-#include <Library/DevicePathLib.h>
 #include <Library/FileHandleLib.h>
 #include <Library/MemoryAllocationLib.h>
 #include <Library/UefiBootServicesTableLib.h>
-#include <Protocol/LoadedImage.h>
 #include <Protocol/SimpleFileSystem.h>
-#include <util/DPUtils.h>
-
-#define CHECK_OPTION(x) (StrnCmp(Line, x L"=", ARRAY_SIZE(x)) == 0)
+#include <util/TftpFs.h>
+#include <util/VolumeUtils.h>
 
 BOOT_KERNEL_ENTRY* gDefaultEntry = NULL;
-LIST_ENTRY gBootEntries = INITIALIZE_LIST_HEAD_VARIABLE(gBootEntries);
+BOOT_ENTRY_TABLE gBootEntries = {};
 
 static CHAR16* ConfigPaths[] = {
     L"boot\\rainloader.cfg",
@@ -28,6 +27,17 @@ static CHAR16* ConfigPaths[] = {
     L"tomatboot.cfg",
 };
 
+// The compiled form of each config, stored right beside it
+static CHAR16* CachePaths[] = {
+    L"boot\\rainloader.cfc",
+    L"rainloader.cfc",
+    L"boot\\tomatboot.cfc",
+    L"tomatboot.cfc",
+};
+
+// Shutdown and reboot
+#define ACTION_ENTRY_COUNT 2
+
 static BOOLEAN ValidateKernelEntry(const BOOT_KERNEL_ENTRY* const Entry) {
     if (Entry == NULL) {
         return FALSE;
@@ -42,44 +52,68 @@ static BOOLEAN ValidateKernelEntry(const BOOT_KERNEL_ENTRY* const Entry) {
 }
 
 BOOT_KERNEL_ENTRY* GetKernelEntryAt(int index) {
-    int i = 0;
-    for (LIST_ENTRY* Link = gBootEntries.ForwardLink; Link != &gBootEntries; Link = Link->ForwardLink, ++i) {
-        if (index == i) {
-            BOOT_ENTRY* TargetEntry = BASE_CR(Link, BOOT_ENTRY, Link);
-            if (TargetEntry->EntryType == BOOT_ENTRY_KERNEL) {
-                return TargetEntry->Entry;
-            }
-            return NULL;
+    if (index < 0 || (UINTN)index >= gBootEntries.EntryCount) {
+        return NULL;
+    }
+
+    BOOT_ENTRY* TargetEntry = &gBootEntries.Entries[index];
+    if (TargetEntry->EntryType == BOOT_ENTRY_KERNEL) {
+        return &TargetEntry->Kernel;
+    }
+    return NULL;
+}
+
+BOOT_KERNEL_ENTRY* FindKernelEntry(CHAR16* Name) {
+    for (UINTN i = 0; i < gBootEntries.EntryCount; ++i) {
+        BOOT_ENTRY* Entry = &gBootEntries.Entries[i];
+        if (Entry->EntryType == BOOT_ENTRY_KERNEL && StrCmp(Entry->Kernel.Name, Name) == 0) {
+            return &Entry->Kernel;
         }
     }
     return NULL;
 }
 
-static CHAR16* CopyString(CHAR16* String) {
-    return AllocateCopyPool((1 + StrLen(String)) * sizeof(CHAR16), String);
+// Makes sure there is room for one more element, the old array is left in
+// the arena, which at most doubles what the array takes
+static EFI_STATUS GrowArray(ARENA* Arena, VOID** Array, UINTN* Capacity, UINTN Count, UINTN ElementSize) {
+    if (Count < *Capacity) {
+        return EFI_SUCCESS;
+    }
+
+    UINTN NewCapacity = *Capacity == 0 ? 8 : *Capacity * 2;
+    VOID* NewArray = ArenaAllocate(Arena, NewCapacity * ElementSize);
+    if (NewArray == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+    if (*Array != NULL) {
+        CopyMem(NewArray, *Array, Count * ElementSize);
+    }
+
+    *Array = NewArray;
+    *Capacity = NewCapacity;
+    return EFI_SUCCESS;
 }
 
-static EFI_STATUS ParseUri(CHAR16* Uri, EFI_SIMPLE_FILE_SYSTEM_PROTOCOL** OutFs, CHAR16** OutPath) {
+// Splits a uri into its root and the path, the path points into the uri
+static EFI_STATUS ParseUri(CHAR16* Uri, BOOT_ROOT* OutRoot, CHAR16** OutPath) {
     EFI_STATUS Status = EFI_SUCCESS;
-    EFI_LOADED_IMAGE_PROTOCOL* LoadedImage = NULL;
-    EFI_DEVICE_PATH* BootDevicePath = NULL;
-    EFI_HANDLE* Handles = NULL;
-    UINTN HandleCount = 0;
 
     CHECK(Uri != NULL);
-    CHECK(OutFs != NULL);
+    CHECK(OutRoot != NULL);
     CHECK(OutPath != NULL);
 
     // separate the domain from the uri type
-    CHAR16* Root = StrStr(Uri, L":");
+    CHAR16* Root = StrStr(Uri, L"://");
+    CHECK_TRACE(Root != NULL, "Invalid uri `%s`", Uri);
     *Root = L'\0';
     Root += 3; // skip ://
 
-    // create the path itself
+    // create the path itself, this points into the uri
     CHAR16* Path = StrStr(Root, L"/");
+    CHECK_TRACE(Path != NULL, "Missing path in uri `%s://%s`", Uri, Root);
     *Path = L'\0';
     Path++; // skip the /
-    *OutPath = CopyString(Path);
+    *OutPath = Path;
 
     // convert `/` to `\` for uefi
     for (CHAR16* C = *OutPath; *C != CHAR_NULL; C++) {
@@ -89,121 +123,587 @@ static EFI_STATUS ParseUri(CHAR16* Uri, EFI_SIMPLE_FILE_SYSTEM_PROTOCOL** OutFs,
     }
 
     // check the uri
+    ZeroMem(OutRoot, sizeof(BOOT_ROOT));
     if (StrCmp(Uri, L"boot") == 0) {
         // boot://[<partition number>]/
 
         if (*Root == L'\0') {
             // The partition number is missing, meaning that the requested
             // path resides on the EFI partition.
+            OutRoot->Type = BOOT_ROOT_CONFIG;
         } else {
-            UINTN PartNum = StrDecimalToUintn(Root);
-
-            // we need the boot drive device path so we can check the filesystems
-            // are on the same drive
-            EFI_CHECK(gBS->HandleProtocol(gImageHandle, &gEfiLoadedImageProtocolGuid, (void**)&LoadedImage));
-            EFI_CHECK(gBS->HandleProtocol(LoadedImage->DeviceHandle, &gEfiDevicePathProtocolGuid, (void**)&BootDevicePath));
-
-            // remove the last part which should be the partition itself
-            BootDevicePath = RemoveLastDevicePathNode(BootDevicePath);
-            CHECK(BootDevicePath != NULL);
-
-            CHAR16* Text = ConvertDevicePathToText(BootDevicePath, TRUE, TRUE);
-            FreePool(Text);
-
-            // Iterate through all protocols
-            EFI_CHECK(gBS->LocateHandleBuffer(ByProtocol, &gEfiSimpleFileSystemProtocolGuid, NULL, &HandleCount, &Handles));
-            int index = -1;
-            for (UINTN i = 0; i < HandleCount; ++i) {
-                EFI_DEVICE_PATH* DevicePath = NULL;
-                EFI_CHECK(gBS->HandleProtocol(Handles[i], &gEfiDevicePathProtocolGuid, (void**)&DevicePath));
-
-                Text = ConvertDevicePathToText(DevicePath, TRUE, TRUE);
-                FreePool(Text);
-
-                // Check this is part of the same drive
-                if (!InsideDevicePath(DevicePath, BootDevicePath)) {
-                    WARN("This is not on the same drive, next");
-                    continue;
+            OutRoot->Type = BOOT_ROOT_PARTITION;
+            OutRoot->Partition = (UINT32)StrDecimalToUintn(Root);
+        }
+    } else if (StrCmp(Uri, L"guid") == 0 || StrCmp(Uri, L"uuid") == 0) {
+        // guid://<guid>/
+        OutRoot->Type = BOOT_ROOT_GUID;
+        EFI_CHECK(StrToGuid(Root, &OutRoot->Guid));
+    } else if (StrCmp(Uri, L"tftp") == 0) {
+        // tftp://<server address>/
+        OutRoot->Type = BOOT_ROOT_TFTP;
+        CHAR16* End = NULL;
+        EFI_CHECK(StrToIpv4Address(Root, &End, &OutRoot->Server, NULL));
+        CHECK_TRACE(*End == CHAR_NULL, "Invalid server address `%s`", Root);
+    } else {
+        CHECK_FAIL_TRACE("Unsupported resource type `%s`", Uri);
+    }
+
+cleanup:
+    return Status;
+}
+
+// Finds the filesystem a root refers to in the volume index
+static EFI_STATUS ResolveRoot(BOOT_ROOT* Root, EFI_SIMPLE_FILE_SYSTEM_PROTOCOL** OutFs) {
+    EFI_STATUS Status = EFI_SUCCESS;
+
+    switch (Root->Type) {
+        case BOOT_ROOT_CONFIG:
+            *OutFs = GetBootVolume();
+            break;
+
+        case BOOT_ROOT_PARTITION:
+            *OutFs = FindBootDrivePartition(Root->Partition);
+            CHECK_TRACE(*OutFs != NULL, "Could not find partition number `%d`", Root->Partition);
+            break;
+
+        case BOOT_ROOT_GUID:
+            *OutFs = FindPartitionByGuid(&Root->Guid);
+            CHECK_TRACE(*OutFs != NULL, "Could not find partition or fs with guid of `%g`", &Root->Guid);
+            break;
+
+        case BOOT_ROOT_TFTP:
+            CHECK_AND_RETHROW(OpenTftpVolume(&Root->Server, OutFs));
+            break;
+
+        default:
+            CHECK_FAIL();
+    }
+
+cleanup:
+    return Status;
+}
+
+typedef enum {
+    CONFIG_KEY_UNKNOWN,
+    CONFIG_KEY_TIMEOUT,
+    CONFIG_KEY_DEFAULT_ENTRY,
+    CONFIG_KEY_PATH,
+    CONFIG_KEY_CMDLINE,
+    CONFIG_KEY_PROTOCOL,
+    CONFIG_KEY_MODULE_PATH,
+    CONFIG_KEY_MODULE_STRING,
+    CONFIG_KEY_SHA256,
+    CONFIG_KEY_MODULE_SHA256,
+    CONFIG_KEY_MODULES_ABOVE_4G,
+    CONFIG_KEY_LOG_LEVEL,
+    CONFIG_KEY_MENU_KEY,
+} CONFIG_KEY;
+
+typedef struct {
+    CHAR16* Name;
+    CONFIG_KEY Key;
+} CONFIG_KEY_SLOT;
+
+// The keys are placed in a perfect hash table, the seed was picked so that
+// no two keys share a slot, so it has to be searched for again whenever a
+// key is added
+#define CONFIG_KEY_SEED 0x6
+#define CONFIG_KEY_SLOTS 64
+
+static CONFIG_KEY_SLOT ConfigKeys[CONFIG_KEY_SLOTS] = {
+    [2] = { L"MODULE_STRING", CONFIG_KEY_MODULE_STRING },
+    [4] = { L"KERNEL_PROTO", CONFIG_KEY_PROTOCOL },
+    [9] = { L"KERNEL_PATH", CONFIG_KEY_PATH },
+    [11] = { L"MODULE_PATH", CONFIG_KEY_MODULE_PATH },
+    [13] = { L"TIMEOUT", CONFIG_KEY_TIMEOUT },
+    [15] = { L"KERNEL_SHA256", CONFIG_KEY_SHA256 },
+    [23] = { L"MODULE_SHA256", CONFIG_KEY_MODULE_SHA256 },
+    [24] = { L"PATH", CONFIG_KEY_PATH },
+    [35] = { L"CMDLINE", CONFIG_KEY_CMDLINE },
+    [37] = { L"SHA256", CONFIG_KEY_SHA256 },
+    [39] = { L"MODULES_ABOVE_4G", CONFIG_KEY_MODULES_ABOVE_4G },
+    [41] = { L"DEFAULT_ENTRY", CONFIG_KEY_DEFAULT_ENTRY },
+    [44] = { L"LOG_LEVEL", CONFIG_KEY_LOG_LEVEL },
+    [45] = { L"KERNEL_PROTOCOL", CONFIG_KEY_PROTOCOL },
+    [48] = { L"MENU_KEY", CONFIG_KEY_MENU_KEY },
+    [55] = { L"KERNEL_CMDLINE", CONFIG_KEY_CMDLINE },
+    [60] = { L"PROTOCOL", CONFIG_KEY_PROTOCOL },
+};
+
+static CONFIG_KEY LookupConfigKey(CHAR16* Name, UINTN Length) {
+    UINT32 Hash = CONFIG_KEY_SEED;
+    for (UINTN i = 0; i < Length; ++i) {
+        Hash = (Hash ^ Name[i]) * 0x01000193;
+    }
+
+    CONFIG_KEY_SLOT* Slot = &ConfigKeys[(Hash >> 16) % CONFIG_KEY_SLOTS];
+    if (Slot->Name == NULL || StrnCmp(Slot->Name, Name, Length) != 0 || Slot->Name[Length] != CHAR_NULL) {
+        return CONFIG_KEY_UNKNOWN;
+    }
+    return Slot->Key;
+}
+
+// The digest is written as 64 hex digits
+static EFI_STATUS ParseSha256(CHAR16* Value, UINT8* Digest) {
+    EFI_STATUS Status = EFI_SUCCESS;
+
+    CHECK_TRACE(StrLen(Value) == SHA256_DIGEST_SIZE * 2, "Invalid SHA256 `%s`", Value);
+    EFI_CHECK(StrHexToBytes(Value, SHA256_DIGEST_SIZE * 2, Digest, SHA256_DIGEST_SIZE));
+
+cleanup:
+    return Status;
+}
+
+typedef struct {
+    BOOT_ENTRY_TABLE* Table;
+    CONFIG_GLOBALS* Globals;
+    BOOT_KERNEL_ENTRY* CurrentEntry;
+    UINTN CurrentModuleString;
+    UINTN EntryCapacity;
+    UINTN ModuleCapacity;
+
+    // The raw config and how far into it we got
+    UINT8* Data;
+    UINTN Size;
+    UINTN Offset;
+    BOOLEAN Utf16;
+
+    // Allows stopping once the entry that is going to be booted right away
+    // has been parsed, the index only counts valid entries
+    BOOLEAN EarlyExit;
+    INTN StopAfterEntry;
+    UINTN ValidEntryCount;
+    BOOLEAN Stopped;
+} CONFIG_PARSER;
+
+static VOID MergeConfigGlobals(CONFIG_GLOBALS* Globals, BOOT_CONFIG* Config) {
+    if (Globals->HasTimeout) {
+        Config->DisableTimer = Globals->DisableTimer;
+        if (!Globals->DisableTimer) {
+            Config->BootDelay = Globals->BootDelay;
+        }
+    }
+
+    if (Globals->HasDefaultEntry) {
+        Config->DefaultOS = Globals->DefaultOS;
+    }
+}
+
+// With a zero timeout the default entry is booted without ever showing the
+// menu, so nothing past it is needed unless that boot fails or is interrupted
+static INTN GetEarlyExitEntry(CONFIG_PARSER* Parser) {
+    if (!Parser->EarlyExit) {
+        return -1;
+    }
+
+    BOOT_CONFIG config = {};
+    LoadBootConfig(&config);
+    MergeConfigGlobals(Parser->Globals, &config);
+    if (config.BootDelay > 0 || config.DefaultOS < 0) {
+        return -1;
+    }
+    return config.DefaultOS;
+}
+
+// Parses a single line which already lives in the string pool, every string
+// we keep points right into it. Referenced is set when anything points into
+// the line, otherwise the caller can reuse its space.
+static EFI_STATUS ParseConfigLine(CONFIG_PARSER* Parser, CHAR16* Line, BOOLEAN* Referenced) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    BOOT_ENTRY_TABLE* Table = Parser->Table;
+    BOOT_KERNEL_ENTRY* CurrentEntry = Parser->CurrentEntry;
+
+    *Referenced = FALSE;
+
+    // New entry
+    if (Line[0] == L':') {
+        // The global keys all come before the first entry, and reaching a new
+        // entry means that the previous one is complete
+        if (CurrentEntry == NULL) {
+            Parser->StopAfterEntry = GetEarlyExitEntry(Parser);
+        } else if (ValidateKernelEntry(CurrentEntry) && (INTN)Parser->ValidEntryCount++ == Parser->StopAfterEntry) {
+            Parser->Stopped = TRUE;
+            goto cleanup;
+        }
+
+        // Got a new entry
+        EFI_CHECK(GrowArray(&Table->Arena, (VOID**)&Table->Entries, &Parser->EntryCapacity, Table->EntryCount, sizeof(BOOT_ENTRY)));
+        BOOT_ENTRY* Entry = &Table->Entries[Table->EntryCount++];
+        ZeroMem(Entry, sizeof(BOOT_ENTRY));
+        Entry->EntryType = BOOT_ENTRY_KERNEL;
+
+        CurrentEntry = &Entry->Kernel;
+        CurrentEntry->Name = Line + 1;
+        CurrentEntry->Protocol = BOOT_INVALID;
+        CurrentEntry->Cmdline = L"";
+        Parser->CurrentEntry = CurrentEntry;
+        Parser->CurrentModuleString = MAX_UINTN;
+        *Referenced = TRUE;
+        goto cleanup;
+    }
+
+    CHAR16* Value = StrStr(Line, L"=");
+    if (Value == NULL) {
+        goto cleanup;
+    }
+    CONFIG_KEY Key = LookupConfigKey(Line, Value - Line);
+    Value++;
+
+    if (CurrentEntry == NULL) {
+        // Global keys
+        switch (Key) {
+            case CONFIG_KEY_TIMEOUT:
+                Parser->Globals->HasTimeout = TRUE;
+                if (StrCmp(Value, L"Disabled") == 0) {
+                    Parser->Globals->DisableTimer = TRUE;
+                } else {
+                    Parser->Globals->DisableTimer = FALSE;
+                    Parser->Globals->BootDelay = (INT32)StrDecimalToUintn(Value);
+                    if (Parser->Globals->BootDelay < 0)
+                        Parser->Globals->BootDelay = 0;
                 }
+                break;
 
-                // Get the last one, and make sure it is a partition.
-                DevicePath = LastDevicePathNode(DevicePath);
-                if (DevicePathType(DevicePath) != MEDIA_DEVICE_PATH || DevicePathSubType(DevicePath) != MEDIA_HARDDRIVE_DP) {
-                    // skip it
-                    WARN("The last node is not a hard drive");
-                    continue;
+            case CONFIG_KEY_DEFAULT_ENTRY:
+                Parser->Globals->HasDefaultEntry = TRUE;
+                Parser->Globals->DefaultOS = (INT32)StrDecimalToUintn(Value);
+                break;
+
+            case CONFIG_KEY_LOG_LEVEL:
+                if (StrCmp(Value, L"error") == 0) {
+                    Parser->Globals->LogLevel = LOG_LEVEL_ERROR;
+                } else if (StrCmp(Value, L"warn") == 0) {
+                    Parser->Globals->LogLevel = LOG_LEVEL_WARN;
+                } else if (StrCmp(Value, L"info") == 0) {
+                    Parser->Globals->LogLevel = LOG_LEVEL_INFO;
+                } else {
+                    CHECK_FAIL_TRACE("Unknown log level `%s`", Value);
                 }
+                Parser->Globals->HasLogLevel = TRUE;
+                break;
 
-                HARDDRIVE_DEVICE_PATH* Hd = (HARDDRIVE_DEVICE_PATH*)DevicePath;
-                if (Hd->PartitionNumber == PartNum) {
-                    index = i;
-                    break;
+            case CONFIG_KEY_MENU_KEY:
+                if (StrCmp(Value, L"any") == 0) {
+                    Parser->Globals->MenuKey = MENU_KEY_ANY;
+                } else if (StrCmp(Value, L"shift") == 0) {
+                    Parser->Globals->MenuKey = MENU_KEY_SHIFT;
+                } else if (StrCmp(Value, L"ctrl") == 0) {
+                    Parser->Globals->MenuKey = MENU_KEY_CTRL;
+                } else if (StrCmp(Value, L"alt") == 0) {
+                    Parser->Globals->MenuKey = MENU_KEY_ALT;
+                } else if (StrCmp(Value, L"none") == 0) {
+                    Parser->Globals->MenuKey = MENU_KEY_NONE;
+                } else {
+                    CHECK_FAIL_TRACE("Unknown menu key `%s`", Value);
                 }
+                Parser->Globals->HasMenuKey = TRUE;
+                break;
+
+            default:
+                break;
+        }
+        goto cleanup;
+    }
+
+    // Local keys
+    switch (Key) {
+        case CONFIG_KEY_PATH:
+            CHECK_AND_RETHROW(ParseUri(Value, &CurrentEntry->Root, &CurrentEntry->Path));
+            *Referenced = TRUE;
+            break;
+
+        case CONFIG_KEY_CMDLINE:
+            CurrentEntry->Cmdline = Value;
+            *Referenced = TRUE;
+            break;
+
+        case CONFIG_KEY_PROTOCOL:
+            if (StrCmp(Value, L"linux") == 0) {
+                CurrentEntry->Protocol = BOOT_LINUX;
+            } else if (StrCmp(Value, L"mb2") == 0) {
+                CurrentEntry->Protocol = BOOT_MB2;
+            } else if (StrCmp(Value, L"linux-efi") == 0) {
+                CurrentEntry->Protocol = BOOT_LINUX_EFI;
+            } else if (StrCmp(Value, L"limine") == 0) {
+                CurrentEntry->Protocol = BOOT_LIMINE;
+            } else {
+                CHECK_FAIL_TRACE("Unknown protocol `%s` for option `%s`", Value, CurrentEntry->Name);
             }
+            break;
 
-            // Make sure we found it
-            CHECK_TRACE(index != -1, "Could not find partition number `%d`", PartNum);
+        case CONFIG_KEY_MODULE_PATH: {
+            // The modules of an entry are always contiguous in the table, so
+            // we only count them here and hand out the pointers at the end
+            EFI_CHECK(GrowArray(&Table->Arena, (VOID**)&Table->Modules, &Parser->ModuleCapacity, Table->ModuleCount, sizeof(BOOT_MODULE)));
+            BOOT_MODULE* Module = &Table->Modules[Table->ModuleCount];
+            ZeroMem(Module, sizeof(BOOT_MODULE));
+            Module->Tag = L"";
+
+            CHECK_AND_RETHROW(ParseUri(Value, &Module->Root, &Module->Path));
+            CurrentEntry->ModuleCount++;
+            *Referenced = TRUE;
+
+            // This is the next one which will need a string
+            if (Parser->CurrentModuleString == MAX_UINTN) {
+                Parser->CurrentModuleString = Table->ModuleCount;
+            }
+            Table->ModuleCount++;
+        } break;
 
-            // Get the filesystem and set it
-            EFI_CHECK(gBS->HandleProtocol(Handles[index], &gEfiSimpleFileSystemProtocolGuid, (void**)OutFs));
-        }
-    } else if (StrCmp(Uri, L"guid") == 0 || StrCmp(Uri, L"uuid") == 0) {
-        // guid://<guid>/
+        case CONFIG_KEY_MODULE_STRING:
+            CHECK_TRACE(
+                CurrentEntry->Protocol == BOOT_MB2 || CurrentEntry->Protocol == BOOT_LIMINE,
+                "`MODULE_STRING` is only available for Multiboot2 and Limine (%d)", CurrentEntry->Protocol);
+            CHECK_TRACE(Parser->CurrentModuleString != MAX_UINTN, "MODULE_PATH must be provided before MODULE_STRING");
 
-        // Parse the guid
-        EFI_GUID Guid;
-        EFI_CHECK(StrToGuid(Root, &Guid));
+            Table->Modules[Parser->CurrentModuleString].Tag = Value;
+            *Referenced = TRUE;
 
-        // Iterate through all protocols
-        EFI_CHECK(gBS->LocateHandleBuffer(ByProtocol, &gEfiSimpleFileSystemProtocolGuid, NULL, &HandleCount, &Handles));
-        int index = -1;
-        for (UINTN i = 0; i < HandleCount; ++i) {
-            EFI_DEVICE_PATH* DevicePath = NULL;
-            EFI_CHECK(gBS->HandleProtocol(Handles[i], &gEfiDevicePathProtocolGuid, (void**)&DevicePath));
+            Parser->CurrentModuleString++;
+            if (Parser->CurrentModuleString == Table->ModuleCount) {
+                Parser->CurrentModuleString = MAX_UINTN;
+            }
+            break;
 
-            // Get the last one, and make sure it is a partition.
-            DevicePath = LastDevicePathNode(DevicePath);
-            if (DevicePathType(DevicePath) != MEDIA_DEVICE_PATH || DevicePathSubType(DevicePath) != MEDIA_HARDDRIVE_DP) {
-                continue;
+        case CONFIG_KEY_SHA256:
+            CHECK_AND_RETHROW(ParseSha256(Value, CurrentEntry->Sha256));
+            CurrentEntry->HasSha256 = TRUE;
+            break;
+
+        case CONFIG_KEY_MODULE_SHA256: {
+            // Applies to the module right before it
+            CHECK_TRACE(CurrentEntry->ModuleCount != 0, "MODULE_PATH must be provided before MODULE_SHA256");
+
+            BOOT_MODULE* Module = &Table->Modules[Table->ModuleCount - 1];
+            CHECK_AND_RETHROW(ParseSha256(Value, Module->Sha256));
+            Module->HasSha256 = TRUE;
+        } break;
+
+        case CONFIG_KEY_MODULES_ABOVE_4G:
+            CHECK_TRACE(
+                CurrentEntry->Protocol == BOOT_MB2,
+                "`MODULES_ABOVE_4G` is only available for Multiboot2 (%d)", CurrentEntry->Protocol);
+
+            if (StrCmp(Value, L"yes") == 0) {
+                CurrentEntry->ModulesAbove4G = TRUE;
+            } else if (StrCmp(Value, L"no") == 0) {
+                CurrentEntry->ModulesAbove4G = FALSE;
+            } else {
+                CHECK_FAIL_TRACE("Expected `yes` or `no` for `MODULES_ABOVE_4G` of option `%s`", CurrentEntry->Name);
             }
+            break;
+
+        default:
+            break;
+    }
 
-            HARDDRIVE_DEVICE_PATH* Hd = (HARDDRIVE_DEVICE_PATH*)DevicePath;
-            if (Hd->SignatureType == SIGNATURE_TYPE_GUID && CompareGuid(&Guid, (EFI_GUID*)Hd->Signature)) {
-                index = i;
+cleanup:
+    return Status;
+}
+
+// Decodes the raw file straight into the string pool one line at a time and
+// parses each line as soon as it is complete, so the data is only walked once.
+// The file is either UTF-8 (which includes plain ASCII) or UTF-16LE with a BOM.
+// If the parser stops early, calling this again picks up where it left off.
+static EFI_STATUS ParseConfig(CONFIG_PARSER* Parser) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    BOOT_ENTRY_TABLE* Table = Parser->Table;
+    UINT8* Data = Parser->Data;
+    UINTN Size = Parser->Size;
+    UINTN Offset = Parser->Offset;
+
+    if (Offset == 0) {
+        if (Size >= 3 && Data[0] == 0xEF && Data[1] == 0xBB && Data[2] == 0xBF) {
+            Offset = 3;
+        } else if (Size >= 2 && Data[0] == 0xFF && Data[1] == 0xFE) {
+            Parser->Utf16 = TRUE;
+            Offset = 2;
+        }
+    }
+
+    CHAR16* Line = Table->Strings + Table->StringsSize;
+    CHAR16* Out = Line;
+    UINTN LineStart = Offset;
+
+    while (TRUE) {
+        CHAR16 C = L'\n';
+
+        if (Offset >= Size) {
+            // Flush the last line if it is missing a line ending
+            if (Out == Line) {
                 break;
             }
+        } else if (Parser->Utf16) {
+            if (Offset + 1 >= Size) {
+                // Drop a stray trailing byte
+                Offset = Size;
+                continue;
+            }
+            C = Data[Offset] | (Data[Offset + 1] << 8);
+            Offset += 2;
+        } else if (Data[Offset] < 0x80) {
+            C = Data[Offset++];
+        } else {
+            // Anything that does not fit in a single UCS-2 character or is
+            // malformed becomes a replacement character
+            UINT8 Lead = Data[Offset++];
+            UINTN Extra = Lead >= 0xF0 ? 3 : Lead >= 0xE0 ? 2 : Lead >= 0xC0 ? 1 : 0;
+            UINT32 CodePoint = Lead & (0x3F >> Extra);
+            C = 0xFFFD;
+            if (Extra != 0 && Offset + Extra <= Size) {
+                UINTN i = 0;
+                for (; i < Extra && (Data[Offset + i] & 0xC0) == 0x80; ++i) {
+                    CodePoint = (CodePoint << 6) | (Data[Offset + i] & 0x3F);
+                }
+                Offset += i;
+                if (i == Extra && CodePoint <= 0xFFFF) {
+                    C = (CHAR16)CodePoint;
+                }
+            }
         }
 
-        CHECK_TRACE(index != -1, "Could not find partition or fs with guid of `%s`", Root);
+        if (C == L'\r') {
+            continue;
+        }
 
-        // Get the filesystem from the guid
-        EFI_CHECK(gBS->HandleProtocol(Handles[index], &gEfiSimpleFileSystemProtocolGuid, (void**)OutFs));
-    } else {
-        CHECK_FAIL_TRACE("Unsupported resource type `%s`", Uri);
+        if (C != L'\n') {
+            *Out++ = C;
+            continue;
+        }
+
+        *Out++ = CHAR_NULL;
+
+        BOOLEAN Referenced = FALSE;
+        CHECK_AND_RETHROW(ParseConfigLine(Parser, Line, &Referenced));
+
+        // The line that made us stop is parsed again when resuming
+        if (Parser->Stopped) {
+            Offset = LineStart;
+            break;
+        }
+
+        // Lines nobody points to are overwritten by the next one
+        if (Referenced) {
+            Table->StringsSize = Out - Table->Strings;
+            Line = Out;
+        } else {
+            Out = Line;
+        }
+        LineStart = Offset;
     }
 
+    Parser->Offset = Offset;
+
 cleanup:
-    if (Handles != NULL) {
-        FreePool(Handles);
+    return Status;
+}
+
+// Copies the valid entries and their modules into tightly sized tables,
+// leaving room for the action entries. The strings were allocated from the
+// arena of the table to begin with, so they are referenced as they are.
+static EFI_STATUS CompactBootEntries(BOOT_ENTRY_TABLE* Parsed, BOOT_ENTRY_TABLE* Table) {
+    EFI_STATUS Status = EFI_SUCCESS;
+
+    // This may be a table built from a partial parse, its arrays are left in
+    // the arena as they only hold the entries up to the default one
+    Table->EntryCount = 0;
+    Table->Modules = NULL;
+    Table->ModuleCount = 0;
+
+    Table->Entries = ArenaAllocate(&Table->Arena, (Parsed->EntryCount + ACTION_ENTRY_COUNT) * sizeof(BOOT_ENTRY));
+    CHECK_ERROR(Table->Entries != NULL, EFI_OUT_OF_RESOURCES);
+    if (Parsed->ModuleCount != 0) {
+        Table->Modules = ArenaAllocate(&Table->Arena, Parsed->ModuleCount * sizeof(BOOT_MODULE));
+        CHECK_ERROR(Table->Modules != NULL, EFI_OUT_OF_RESOURCES);
     }
 
-    if (BootDevicePath != NULL) {
-        FreePool(BootDevicePath);
+    BOOT_MODULE* Modules = Parsed->Modules;
+    for (UINTN i = 0; i < Parsed->EntryCount; ++i) {
+        BOOT_KERNEL_ENTRY* KernelEntry = &Parsed->Entries[i].Kernel;
+        if (ValidateKernelEntry(KernelEntry)) {
+            BOOT_ENTRY* Entry = &Table->Entries[Table->EntryCount++];
+            CopyMem(Entry, &Parsed->Entries[i], sizeof(BOOT_ENTRY));
+            Entry->Kernel.Modules = &Table->Modules[Table->ModuleCount];
+            CopyMem(Entry->Kernel.Modules, Modules, KernelEntry->ModuleCount * sizeof(BOOT_MODULE));
+            Table->ModuleCount += KernelEntry->ModuleCount;
+        }
+        Modules += KernelEntry->ModuleCount;
     }
 
+    Table->Strings = Parsed->Strings;
+    Table->StringsSize = Parsed->StringsSize;
+
+cleanup:
     return Status;
 }
 
-static EFI_STATUS LoadBootEntries(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* FS, LIST_ENTRY* Head) {
+static VOID ApplyConfigGlobals(CONFIG_GLOBALS* Globals) {
+    if (Globals->HasLogLevel) {
+        SetLogLevel(Globals->LogLevel);
+    }
+
+    if (Globals->HasMenuKey) {
+        SetMenuKey(Globals->MenuKey);
+    }
+
+    BOOT_CONFIG config = {};
+    LoadBootConfig(&config);
+    MergeConfigGlobals(Globals, &config);
+    SaveBootConfig(&config);
+}
+
+static VOID AppendActionEntry(BOOT_ENTRY_TABLE* Table, const BOOT_ACTION_TYPE Action, CHAR16* Name) {
+    BOOT_ENTRY* Entry = &Table->Entries[Table->EntryCount++];
+    Entry->EntryType = BOOT_ENTRY_ACTION;
+    Entry->Action.Action = Action;
+    Entry->Action.Name = Name;
+}
+
+static VOID AppendActionEntries(BOOT_ENTRY_TABLE* Table) {
+    AppendActionEntry(Table, BOOT_ACTION_SHUTDOWN, L"Shutdown");
+    AppendActionEntry(Table, BOOT_ACTION_REBOOT, L"Reboot");
+}
+
+// Everything needed to finish a parse that stopped early
+static struct {
+    BOOLEAN Active;
+    BOOT_ENTRY_TABLE* Table;
+    BOOT_ENTRY_TABLE Parsed;
+    CONFIG_PARSER Parser;
+    CONFIG_GLOBALS Globals;
+    EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* Fs;
+    CHAR16* CachePath;
+    EFI_FILE_INFO* Info;
+    UINT64 Hash;
+} mPendingParse = {};
+
+static VOID FreePendingParse(VOID) {
+    FreeBootEntries(&mPendingParse.Parsed);
+
+    if (mPendingParse.Parser.Data != NULL) {
+        FreePool(mPendingParse.Parser.Data);
+    }
+
+    if (mPendingParse.Info != NULL) {
+        FreePool(mPendingParse.Info);
+    }
+
+    ZeroMem(&mPendingParse, sizeof(mPendingParse));
+}
+
+static EFI_STATUS LoadBootEntries(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* FS, BOOT_ENTRY_TABLE* Table) {
     EFI_STATUS Status = EFI_SUCCESS;
     EFI_FILE_PROTOCOL* root = NULL;
     EFI_FILE_PROTOCOL* file = NULL;
+    CONFIG_CACHE_HEADER* Cache = NULL;
+    UINTN i = 0;
 
     // Open the configuration
     CHECK(FS != NULL);
     EFI_CHECK(FS->OpenVolume(FS, &root));
 
-    for (UINTN i = 0; i < ARRAY_SIZE(ConfigPaths); ++i) {
+    for (i = 0; i < ARRAY_SIZE(ConfigPaths); ++i) {
         if (!EFI_ERROR(root->Open(root, &file, ConfigPaths[i], EFI_FILE_MODE_READ, 0))) {
             break;
         }
@@ -216,106 +716,78 @@ static EFI_STATUS LoadBootEntries(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* FS, LIST_ENTR
         goto cleanup;
     }
 
-    // Start from a clean state
-    *Head = (LIST_ENTRY)INITIALIZE_LIST_HEAD_VARIABLE(*Head);
-    BOOT_ENTRY* CurrentWrapperEntry = NULL;
-    BOOT_MODULE* CurrentModuleString = NULL;
+    mPendingParse.Table = Table;
+    mPendingParse.Fs = FS;
+    mPendingParse.CachePath = CachePaths[i];
+    mPendingParse.Info = FileHandleGetInfo(file);
+    CHECK_ERROR(mPendingParse.Info != NULL, EFI_OUT_OF_RESOURCES);
+    EFI_FILE_INFO* Info = mPendingParse.Info;
+
+    // The cache is only trusted if it was compiled from these exact contents,
+    // a same size edit can keep the time (FAT only has 2 second granularity,
+    // and copying tools may keep it too)
+    if (EFI_ERROR(ReadConfigCache(root, CachePaths[i], &Cache))) {
+        Cache = NULL;
+    }
 
-    BOOT_CONFIG config = {};
-    LoadBootConfig(&config);
+    // Read the whole file in one go
+    UINT8* Data = NULL;
+    if (Info->FileSize != 0) {
+        Data = AllocatePool(Info->FileSize);
+        CHECK_ERROR(Data != NULL, EFI_OUT_OF_RESOURCES);
+        mPendingParse.Parser.Data = Data;
+        CHECK_AND_RETHROW(FileRead(file, Data, Info->FileSize, 0));
+    }
 
-    while (TRUE) {
-        CHAR16 Line[255] = {0};
-        UINTN LineSize = sizeof(Line);
-        BOOLEAN Ascii = TRUE;
+    mPendingParse.Hash = HashConfig(Data, Info->FileSize);
+    if (Cache != NULL && ConfigCacheHashMatches(Cache, Info->FileSize, mPendingParse.Hash)) {
+        CHECK_AND_RETHROW(LoadConfigCache(Cache, Table, ACTION_ENTRY_COUNT, &mPendingParse.Globals));
+        ApplyConfigGlobals(&mPendingParse.Globals);
 
-        if (FileHandleEof(file)) {
-            break;
+        // Only the time is stale, so refresh it without rewriting on every boot
+        if (!ConfigCacheTimeMatches(Cache, Info)) {
+            WriteConfigCache(root, CachePaths[i], Info, mPendingParse.Hash, Table, &mPendingParse.Globals);
         }
-        EFI_CHECK(FileHandleReadLine(file, Line, &LineSize, FALSE, &Ascii));
-
-        // New entry
-        if (Line[0] == L':') {
-            // Got a new entry
-            BOOT_KERNEL_ENTRY* KernelEntry = NULL;
-            KernelEntry = AllocateZeroPool(sizeof(BOOT_KERNEL_ENTRY));
-            KernelEntry->Fs = FS;
-            KernelEntry->Name = CopyString(Line + 1);
-            KernelEntry->Protocol = BOOT_INVALID;
-            KernelEntry->Cmdline = L"";
-            KernelEntry->BootModules = (LIST_ENTRY)INITIALIZE_LIST_HEAD_VARIABLE(KernelEntry->BootModules);
-
-            CurrentWrapperEntry = AllocateZeroPool(sizeof(BOOT_ENTRY));
-            CurrentWrapperEntry->EntryType = BOOT_ENTRY_KERNEL;
-            CurrentWrapperEntry->Entry = KernelEntry;
-            InsertTailList(Head, &CurrentWrapperEntry->Link);
-            CurrentModuleString = NULL;
-
-            // Global keys
-        } else if (CurrentWrapperEntry == NULL) {
-            if (CHECK_OPTION(L"TIMEOUT")) {
-                if (StrCmp(StrStr(Line, L"=") + 1, L"Disabled") == 0) {
-                    config.DisableTimer = TRUE;
-                } else {
-                    config.DisableTimer = FALSE;
-                    config.BootDelay = (INT32)StrDecimalToUintn(StrStr(Line, L"=") + 1);
-                    if (config.BootDelay < 0)
-                        config.BootDelay = 0;
-                }
-            } else if (CHECK_OPTION(L"DEFAULT_ENTRY")) {
-                config.DefaultOS = (INT32)StrDecimalToUintn(StrStr(Line, L"=") + 1);
-            }
-        } else {
-            // Local keys
-            BOOT_KERNEL_ENTRY* CurrentEntry = CurrentWrapperEntry->Entry;
-            if (CHECK_OPTION(L"PATH") || CHECK_OPTION(L"KERNEL_PATH")) {
-                CHAR16* Path = StrStr(Line, L"=") + 1;
-                CHECK_AND_RETHROW(ParseUri(Path, &CurrentEntry->Fs, &CurrentEntry->Path));
-            } else if (CHECK_OPTION(L"CMDLINE") || CHECK_OPTION(L"KERNEL_CMDLINE")) {
-                CurrentEntry->Cmdline = CopyString(StrStr(Line, L"=") + 1);
-            } else if (CHECK_OPTION(L"PROTOCOL") || CHECK_OPTION(L"KERNEL_PROTO") || CHECK_OPTION(L"KERNEL_PROTOCOL")) {
-                CHAR16* Protocol = StrStr(Line, L"=") + 1;
-
-                if (StrCmp(Protocol, L"linux") == 0) {
-                    CurrentEntry->Protocol = BOOT_LINUX;
-                } else if (StrCmp(Protocol, L"mb2") == 0) {
-                    CurrentEntry->Protocol = BOOT_MB2;
-                } else {
-                    CHECK_FAIL_TRACE("Unknown protocol `%s` for option `%s`", Protocol, CurrentEntry->Name);
-                }
-            } else if (CHECK_OPTION(L"MODULE_PATH")) {
-                CHAR16* Path = StrStr(Line, L"=") + 1;
-
-                BOOT_MODULE* Module = AllocateZeroPool(sizeof(BOOT_MODULE));
-                Module->Fs = FS;
-                Module->Tag = L"";
-                CHECK_AND_RETHROW(ParseUri(Path, &Module->Fs, &Module->Path));
-                InsertTailList(&CurrentEntry->BootModules, &Module->Link);
-
-                // This is the next one which will need a string
-                if (CurrentModuleString == NULL) {
-                    CurrentModuleString = Module;
-                }
-            } else if (CHECK_OPTION(L"MODULE_STRING")) {
-                CHECK_TRACE(
-                    CurrentEntry->Protocol == BOOT_MB2,
-                    "`MODULE_STRING` is only available for Multiboot2 (%d)", CurrentEntry->Protocol);
-                CHECK_TRACE(CurrentModuleString != NULL, "MODULE_PATH must be provided before MODULE_STRING");
-
-                CurrentModuleString->Tag = CopyString(StrStr(Line, L"=") + 1);
+        goto cleanup;
+    }
 
-                if (IsNodeAtEnd(&CurrentEntry->BootModules, &CurrentModuleString->Link)) {
-                    CurrentModuleString = NULL;
-                } else {
-                    CurrentModuleString = BASE_CR(GetNextNode(&CurrentEntry->BootModules, &CurrentModuleString->Link), BOOT_MODULE, Link);
-                }
-            }
-        }
+    // Every character decodes from at least one byte, so the file size is an
+    // upper bound for the string pool, including the terminator of a final
+    // line without a line ending. The entries point into it, so it lives in
+    // the arena of the final table while the parsed one is only scratch.
+    BOOT_ENTRY_TABLE* Parsed = &mPendingParse.Parsed;
+    Parsed->Strings = ArenaAllocate(&Table->Arena, (Info->FileSize + 1) * sizeof(CHAR16));
+    CHECK_ERROR(Parsed->Strings != NULL, EFI_OUT_OF_RESOURCES);
+
+    CONFIG_PARSER* Parser = &mPendingParse.Parser;
+    Parser->Table = Parsed;
+    Parser->Globals = &mPendingParse.Globals;
+    Parser->CurrentModuleString = MAX_UINTN;
+    Parser->Size = Info->FileSize;
+    Parser->EarlyExit = TRUE;
+    Parser->StopAfterEntry = -1;
+    CHECK_AND_RETHROW(ParseConfig(Parser));
+
+    CHECK_AND_RETHROW(CompactBootEntries(Parsed, Table));
+    ApplyConfigGlobals(&mPendingParse.Globals);
+
+    // The rest is parsed by FinishBootEntries if it is ever needed
+    if (Parser->Stopped) {
+        mPendingParse.Active = TRUE;
+        goto cleanup;
     }
 
-    SaveBootConfig(&config);
+    WriteConfigCache(root, CachePaths[i], Info, mPendingParse.Hash, Table, &mPendingParse.Globals);
 
 cleanup:
+    if (!mPendingParse.Active) {
+        FreePendingParse();
+    }
+
+    if (Cache != NULL) {
+        FreePool(Cache);
+    }
+
     if (file != NULL) {
         FileHandleClose(file);
     }
@@ -327,71 +799,79 @@ cleanup:
     return Status;
 }
 
-static VOID AppendActionEntry(const BOOT_ACTION_TYPE Action, CHAR16* Name, LIST_ENTRY* Head) {
-    BOOT_ACTION_ENTRY* Entry = NULL;
-    Entry = AllocateZeroPool(sizeof(BOOT_ACTION_ENTRY));
-    Entry->Action = Action;
-    Entry->Name = Name;
-
-    BOOT_ENTRY* CurrentWrapperEntry = NULL;
-    CurrentWrapperEntry = AllocateZeroPool(sizeof(BOOT_ENTRY));
-    CurrentWrapperEntry->EntryType = BOOT_ENTRY_ACTION;
-    CurrentWrapperEntry->Entry = Entry;
-    InsertTailList(Head, &CurrentWrapperEntry->Link);
+EFI_STATUS FinishBootEntries(VOID) {
+    EFI_STATUS Status = EFI_SUCCESS;
+
+    if (!mPendingParse.Active) {
+        goto cleanup;
+    }
+
+    CONFIG_PARSER* Parser = &mPendingParse.Parser;
+    Parser->Stopped = FALSE;
+    Parser->StopAfterEntry = -1;
+    CHECK_AND_RETHROW(ParseConfig(Parser));
+
+    BOOT_ENTRY_TABLE* Table = mPendingParse.Table;
+    CHECK_AND_RETHROW(CompactBootEntries(&mPendingParse.Parsed, Table));
+    AppendActionEntries(Table);
+
+    // Not being able to write the cache only costs us time on the next boot
+    EFI_FILE_PROTOCOL* root = NULL;
+    if (!EFI_ERROR(mPendingParse.Fs->OpenVolume(mPendingParse.Fs, &root))) {
+        WriteConfigCache(root, mPendingParse.CachePath, mPendingParse.Info, mPendingParse.Hash, Table, &mPendingParse.Globals);
+        FileHandleClose(root);
+    }
+
+    FreePendingParse();
+
+cleanup:
+    return Status;
+}
+
+EFI_STATUS ResolveBootEntry(BOOT_KERNEL_ENTRY* Entry) {
+    EFI_STATUS Status = EFI_SUCCESS;
+
+    CHECK(Entry != NULL);
+
+    CHECK_AND_RETHROW(ResolveRoot(&Entry->Root, &Entry->Fs));
+    for (UINTN i = 0; i < Entry->ModuleCount; ++i) {
+        BOOT_MODULE* Module = &Entry->Modules[i];
+        CHECK_AND_RETHROW(ResolveRoot(&Module->Root, &Module->Fs));
+    }
+
+cleanup:
+    return Status;
 }
 
 BOOLEAN ContainsKernel(VOID) {
-    for (LIST_ENTRY* Link = gBootEntries.ForwardLink; Link != &gBootEntries; Link = Link->ForwardLink) {
-        if (BASE_CR(Link, BOOT_ENTRY, Link)->EntryType == BOOT_ENTRY_KERNEL) {
+    for (UINTN i = 0; i < gBootEntries.EntryCount; ++i) {
+        if (gBootEntries.Entries[i].EntryType == BOOT_ENTRY_KERNEL) {
             return TRUE;
         }
     }
     return FALSE;
 }
 
-VOID FreeModules(LIST_ENTRY* Head) {
-    LIST_ENTRY* Entry;
-    LIST_ENTRY* Next;
-    BASE_LIST_FOR_EACH_SAFE(Entry, Next, Head) {
-        BOOT_MODULE* BootModule = BASE_CR(Entry, BOOT_MODULE, Link);
-        FreePool(BootModule);
-    }
+VOID FreeBootEntries(BOOT_ENTRY_TABLE* Table) {
+    FreeArena(&Table->Arena);
+    ZeroMem(Table, sizeof(BOOT_ENTRY_TABLE));
 }
 
-EFI_STATUS GetBootEntries(LIST_ENTRY* Head) {
+EFI_STATUS GetBootEntries(BOOT_ENTRY_TABLE* Table) {
     EFI_STATUS Status = EFI_SUCCESS;
-    EFI_LOADED_IMAGE_PROTOCOL* LoadedImage = NULL;
-    EFI_DEVICE_PATH_PROTOCOL* BootDevicePath = NULL;
-    EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* BootFs = NULL;
-    EFI_HANDLE FsHandle = NULL;
-
-    // Get the boot image device path
-    EFI_CHECK(gBS->HandleProtocol(gImageHandle, &gEfiLoadedImageProtocolGuid, (void**)&LoadedImage));
-    EFI_CHECK(gBS->HandleProtocol(LoadedImage->DeviceHandle, &gEfiDevicePathProtocolGuid, (void**)&BootDevicePath));
-
-    // Locate the file system
-    EFI_CHECK(gBS->LocateDevicePath(&gEfiSimpleFileSystemProtocolGuid, &BootDevicePath, &FsHandle));
-    EFI_CHECK(gBS->HandleProtocol(FsHandle, &gEfiSimpleFileSystemProtocolGuid, (void**)&BootFs));
-
-    // Try to load a config from it
-    CHECK_AND_RETHROW(LoadBootEntries(BootFs, Head));
-
-    // Validate all entries and drop invalid ones
-    LIST_ENTRY* Entry;
-    LIST_ENTRY* Next;
-    BASE_LIST_FOR_EACH_SAFE(Entry, Next, Head) {
-        BOOT_ENTRY* EntryWrapper = BASE_CR(Entry, BOOT_ENTRY, Link);
-        if (!ValidateKernelEntry(EntryWrapper->Entry)) {
-            RemoveEntryList(Entry);
-            BOOT_KERNEL_ENTRY* KernelEntry = EntryWrapper->Entry;
-            FreeModules(&KernelEntry->BootModules);
-            FreePool(KernelEntry);
-            FreePool(EntryWrapper);
-        }
+
+    ZeroMem(Table, sizeof(BOOT_ENTRY_TABLE));
+
+    // Try to load a config from the boot filesystem
+    CHECK_AND_RETHROW(LoadBootEntries(GetBootVolume(), Table));
+
+    // Without a config there is nothing but the action entries
+    if (Table->Entries == NULL) {
+        Table->Entries = ArenaAllocate(&Table->Arena, ACTION_ENTRY_COUNT * sizeof(BOOT_ENTRY));
+        CHECK_ERROR(Table->Entries != NULL, EFI_OUT_OF_RESOURCES);
     }
 
-    AppendActionEntry(BOOT_ACTION_SHUTDOWN, L"Shutdown", Head);
-    AppendActionEntry(BOOT_ACTION_REBOOT, L"Reboot", Head);
+    AppendActionEntries(Table);
 
 cleanup:
     return Status;
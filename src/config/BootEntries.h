@@ -4,6 +4,9 @@
 
 #include <Protocol/SimpleFileSystem.h>
 
+#include <util/Arena.h>
+#include <util/Sha256.h>
+
 typedef enum {
     BOOT_ENTRY_KERNEL,
     BOOT_ENTRY_ACTION,
@@ -18,13 +21,33 @@ typedef enum {
     BOOT_INVALID,
     BOOT_LINUX,
     BOOT_MB2,
+    BOOT_LINUX_EFI, // Linux started through the EFI stub of its bzImage
+    BOOT_LIMINE,
 } BOOT_PROTOCOL;
 
+typedef enum {
+    BOOT_ROOT_CONFIG,    // boot:///, the filesystem the config was found on
+    BOOT_ROOT_PARTITION, // boot://<partition number>/
+    BOOT_ROOT_GUID,      // guid://<guid>/
+    BOOT_ROOT_TFTP,      // tftp://<server address>/
+} BOOT_ROOT_TYPE;
+
+// Where a path lives, this is kept in its parsed form so that it can be
+// cached, and is only resolved to a filesystem when the entry is booted
+typedef struct {
+    BOOT_ROOT_TYPE Type;
+    UINT32 Partition;
+    EFI_GUID Guid;
+    EFI_IPv4_ADDRESS Server;
+} BOOT_ROOT;
+
 typedef struct {
-    LIST_ENTRY Link;
+    BOOT_ROOT Root;
     EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* Fs;
     CHAR16* Path;
     CHAR16* Tag;
+    BOOLEAN HasSha256; // The file is refused unless it matches the digest
+    UINT8 Sha256[SHA256_DIGEST_SIZE];
 } BOOT_MODULE;
 
 typedef struct {
@@ -35,24 +58,55 @@ typedef struct {
 typedef struct {
     BOOT_PROTOCOL Protocol;
     CHAR16* Name;
+    BOOT_ROOT Root;
     EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* Fs;
     CHAR16* Path;
     CHAR16* Cmdline;
-    LIST_ENTRY BootModules;
+    BOOLEAN HasSha256;
+    UINT8 Sha256[SHA256_DIGEST_SIZE];
+    BOOLEAN ModulesAbove4G; // The MB2 kernel knows the 64-bit module tag
+    BOOT_MODULE* Modules; // Points into the module table
+    UINTN ModuleCount;
 } BOOT_KERNEL_ENTRY;
 
 typedef struct {
     BOOT_ENTRY_TYPE EntryType;
-    VOID* Entry;
-    LIST_ENTRY Link;
+    union {
+        BOOT_KERNEL_ENTRY Kernel;
+        BOOT_ACTION_ENTRY Action;
+    };
 } BOOT_ENTRY;
 
+// The parsed configuration, every entry, module and string lives in one of
+// three contiguous arrays, which are all allocated from the arena
+typedef struct {
+    BOOT_ENTRY* Entries;
+    UINTN EntryCount;
+    BOOT_MODULE* Modules;
+    UINTN ModuleCount;
+    CHAR16* Strings;
+    UINTN StringsSize; // In characters
+    ARENA Arena;
+} BOOT_ENTRY_TABLE;
+
 extern BOOT_KERNEL_ENTRY* gDefaultEntry;
-extern LIST_ENTRY gBootEntries;
+extern BOOT_ENTRY_TABLE gBootEntries;
 
 BOOT_KERNEL_ENTRY* GetKernelEntryAt(int i);
+BOOT_KERNEL_ENTRY* FindKernelEntry(CHAR16* Name);
 BOOLEAN ContainsKernel(VOID);
 
-// Provides a linked list all the boot entries found in the configuration
-// files across all detected filesystems
-EFI_STATUS GetBootEntries(LIST_ENTRY* Head);
+// Builds the table of all the boot entries found in the configuration
+// file on the boot filesystem
+EFI_STATUS GetBootEntries(BOOT_ENTRY_TABLE* Table);
+
+// A zero timeout boot only parses the config up to the default entry, this
+// parses the rest of it, after which all the entry pointers are invalid
+EFI_STATUS FinishBootEntries(VOID);
+
+// Finds the filesystems of the entry and its modules, this is only done once
+// the entry is actually booted
+EFI_STATUS ResolveBootEntry(BOOT_KERNEL_ENTRY* Entry);
+
+// Releases everything owned by the table
+VOID FreeBootEntries(BOOT_ENTRY_TABLE* Table);
@@ -0,0 +1,309 @@
+#include "ConfigCache.h"
+
+#include <util/Except.h>
+#include <util/FileUtils.h>
+
+#include <Uefi.h>
+
+#include <Library/BaseMemoryLib.h>
+#include <Library/FileHandleLib.h>
+#include <Library/MemoryAllocationLib.h>
+
+UINT64 HashConfig(const UINT8* Data, UINTN Size) {
+    UINT64 Hash = 0xcbf29ce484222325;
+    for (UINTN i = 0; i < Size; ++i) {
+        Hash = (Hash ^ Data[i]) * 0x100000001b3;
+    }
+    return Hash;
+}
+
+static BOOLEAN ValidateString(CONFIG_CACHE_HEADER* Cache, UINT32 Offset) {
+    return Offset == CONFIG_CACHE_NO_STRING || Offset < Cache->StringsSize;
+}
+
+static BOOLEAN ValidateRoot(CONFIG_CACHE_ROOT* Root) {
+    return Root->Type <= BOOT_ROOT_TFTP;
+}
+
+EFI_STATUS ReadConfigCache(EFI_FILE_PROTOCOL* Root, CHAR16* Path, CONFIG_CACHE_HEADER** Cache) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    EFI_FILE_PROTOCOL* File = NULL;
+    CONFIG_CACHE_HEADER* Header = NULL;
+
+    // Not having a cache is not an error
+    if (EFI_ERROR(Root->Open(Root, &File, Path, EFI_FILE_MODE_READ, 0))) {
+        File = NULL;
+        Status = EFI_NOT_FOUND;
+        goto cleanup;
+    }
+
+    UINT64 Size = 0;
+    EFI_CHECK(FileHandleGetSize(File, &Size));
+    CHECK(Size >= sizeof(CONFIG_CACHE_HEADER));
+
+    Header = AllocatePool(Size);
+    CHECK_ERROR(Header != NULL, EFI_OUT_OF_RESOURCES);
+    CHECK_AND_RETHROW(FileRead(File, Header, Size, 0));
+
+    // An outdated cache is simply rebuilt
+    if (Header->Magic != CONFIG_CACHE_MAGIC || Header->Version != CONFIG_CACHE_VERSION) {
+        Status = EFI_INCOMPATIBLE_VERSION;
+        goto cleanup;
+    }
+
+    UINT64 Expected = sizeof(CONFIG_CACHE_HEADER)
+        + (UINT64)Header->EntryCount * sizeof(CONFIG_CACHE_ENTRY)
+        + (UINT64)Header->ModuleCount * sizeof(CONFIG_CACHE_MODULE)
+        + (UINT64)Header->StringsSize * sizeof(CHAR16);
+    CHECK_TRACE(Size == Expected, "Config cache `%s` is truncated", Path);
+
+    // Make sure every offset in it is sane so it can be used as is
+    CONFIG_CACHE_ENTRY* Entries = (CONFIG_CACHE_ENTRY*)(Header + 1);
+    CONFIG_CACHE_MODULE* Modules = (CONFIG_CACHE_MODULE*)(Entries + Header->EntryCount);
+    CHAR16* Strings = (CHAR16*)(Modules + Header->ModuleCount);
+
+    CHECK(Header->StringsSize == 0 || Strings[Header->StringsSize - 1] == CHAR_NULL);
+
+    UINT64 ModuleCount = 0;
+    for (UINTN i = 0; i < Header->EntryCount; ++i) {
+        CONFIG_CACHE_ENTRY* Entry = &Entries[i];
+        CHECK(Entry->Protocol == BOOT_LINUX || Entry->Protocol == BOOT_MB2 || Entry->Protocol == BOOT_LINUX_EFI || Entry->Protocol == BOOT_LIMINE);
+        CHECK(Entry->Name != CONFIG_CACHE_NO_STRING && ValidateString(Header, Entry->Name));
+        CHECK(Entry->Path != CONFIG_CACHE_NO_STRING && ValidateString(Header, Entry->Path));
+        CHECK(ValidateString(Header, Entry->Cmdline));
+        CHECK(ValidateRoot(&Entry->Root));
+        ModuleCount += Entry->ModuleCount;
+    }
+    CHECK(ModuleCount == Header->ModuleCount);
+
+    for (UINTN i = 0; i < Header->ModuleCount; ++i) {
+        CONFIG_CACHE_MODULE* Module = &Modules[i];
+        CHECK(Module->Path != CONFIG_CACHE_NO_STRING && ValidateString(Header, Module->Path));
+        CHECK(ValidateString(Header, Module->Tag));
+        CHECK(ValidateRoot(&Module->Root));
+    }
+
+    *Cache = Header;
+    Header = NULL;
+
+cleanup:
+    if (Header != NULL) {
+        FreePool(Header);
+    }
+
+    if (File != NULL) {
+        FileHandleClose(File);
+    }
+
+    return Status;
+}
+
+BOOLEAN ConfigCacheTimeMatches(CONFIG_CACHE_HEADER* Cache, EFI_FILE_INFO* Info) {
+    // Caches built on the host have no time, since it would never match the
+    // one the firmware reports
+    if (Cache->SourceTime.Year == 0) {
+        return FALSE;
+    }
+
+    return Cache->SourceSize == Info->FileSize
+        && CompareMem(&Cache->SourceTime, &Info->ModificationTime, sizeof(EFI_TIME)) == 0;
+}
+
+BOOLEAN ConfigCacheHashMatches(CONFIG_CACHE_HEADER* Cache, UINT64 Size, UINT64 Hash) {
+    return Cache->SourceSize == Size && Cache->SourceHash == Hash;
+}
+
+static CHAR16* GetString(BOOT_ENTRY_TABLE* Table, UINT32 Offset) {
+    if (Offset == CONFIG_CACHE_NO_STRING) {
+        return L"";
+    }
+    return Table->Strings + Offset;
+}
+
+static VOID LoadRoot(BOOT_ROOT* Root, CONFIG_CACHE_ROOT* Cached) {
+    Root->Type = (BOOT_ROOT_TYPE)Cached->Type;
+    Root->Partition = Cached->Partition;
+    CopyGuid(&Root->Guid, &Cached->Guid);
+    CopyMem(&Root->Server, &Cached->Server, sizeof(EFI_IPv4_ADDRESS));
+}
+
+EFI_STATUS LoadConfigCache(CONFIG_CACHE_HEADER* Cache, BOOT_ENTRY_TABLE* Table, UINTN ExtraEntries, CONFIG_GLOBALS* Globals) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    CONFIG_CACHE_ENTRY* Entries = (CONFIG_CACHE_ENTRY*)(Cache + 1);
+    CONFIG_CACHE_MODULE* Modules = (CONFIG_CACHE_MODULE*)(Entries + Cache->EntryCount);
+    CHAR16* Strings = (CHAR16*)(Modules + Cache->ModuleCount);
+
+    ZeroMem(Table, sizeof(BOOT_ENTRY_TABLE));
+
+    Table->Entries = ArenaAllocate(&Table->Arena, (Cache->EntryCount + ExtraEntries) * sizeof(BOOT_ENTRY));
+    CHECK_ERROR(Table->Entries != NULL, EFI_OUT_OF_RESOURCES);
+    if (Cache->ModuleCount != 0) {
+        Table->Modules = ArenaAllocate(&Table->Arena, Cache->ModuleCount * sizeof(BOOT_MODULE));
+        CHECK_ERROR(Table->Modules != NULL, EFI_OUT_OF_RESOURCES);
+    }
+    if (Cache->StringsSize != 0) {
+        Table->Strings = ArenaAllocateCopy(&Table->Arena, Cache->StringsSize * sizeof(CHAR16), Strings);
+        CHECK_ERROR(Table->Strings != NULL, EFI_OUT_OF_RESOURCES);
+        Table->StringsSize = Cache->StringsSize;
+    }
+
+    for (UINTN i = 0; i < Cache->ModuleCount; ++i) {
+        BOOT_MODULE* Module = &Table->Modules[i];
+        LoadRoot(&Module->Root, &Modules[i].Root);
+        Module->Fs = NULL;
+        Module->Path = GetString(Table, Modules[i].Path);
+        Module->Tag = GetString(Table, Modules[i].Tag);
+        Module->HasSha256 = Modules[i].HasSha256;
+        CopyMem(Module->Sha256, Modules[i].Sha256, SHA256_DIGEST_SIZE);
+    }
+
+    for (UINTN i = 0; i < Cache->EntryCount; ++i) {
+        BOOT_ENTRY* Entry = &Table->Entries[i];
+        ZeroMem(Entry, sizeof(BOOT_ENTRY));
+        Entry->EntryType = BOOT_ENTRY_KERNEL;
+
+        BOOT_KERNEL_ENTRY* Kernel = &Entry->Kernel;
+        Kernel->Protocol = (BOOT_PROTOCOL)Entries[i].Protocol;
+        Kernel->Name = GetString(Table, Entries[i].Name);
+        Kernel->Path = GetString(Table, Entries[i].Path);
+        Kernel->Cmdline = GetString(Table, Entries[i].Cmdline);
+        LoadRoot(&Kernel->Root, &Entries[i].Root);
+        Kernel->HasSha256 = Entries[i].HasSha256;
+        CopyMem(Kernel->Sha256, Entries[i].Sha256, SHA256_DIGEST_SIZE);
+        Kernel->ModulesAbove4G = Entries[i].ModulesAbove4G;
+        Kernel->Modules = &Table->Modules[Table->ModuleCount];
+        Kernel->ModuleCount = Entries[i].ModuleCount;
+        Table->ModuleCount += Kernel->ModuleCount;
+    }
+    Table->EntryCount = Cache->EntryCount;
+
+    Globals->HasTimeout = Cache->HasTimeout;
+    Globals->DisableTimer = Cache->DisableTimer;
+    Globals->BootDelay = Cache->BootDelay;
+    Globals->HasDefaultEntry = Cache->HasDefaultEntry;
+    Globals->DefaultOS = Cache->DefaultOS;
+    Globals->HasLogLevel = Cache->LogLevel != 0;
+    Globals->LogLevel = Globals->HasLogLevel ? Cache->LogLevel - 1 : 0;
+    Globals->HasMenuKey = Cache->MenuKey != 0;
+    Globals->MenuKey = Globals->HasMenuKey ? Cache->MenuKey - 1 : 0;
+
+cleanup:
+    if (EFI_ERROR(Status)) {
+        FreeBootEntries(Table);
+    }
+
+    return Status;
+}
+
+static UINT32 StoreString(BOOT_ENTRY_TABLE* Table, CHAR16* String) {
+    // Anything outside of the pool is a literal empty string
+    if (String < Table->Strings || String >= Table->Strings + Table->StringsSize) {
+        return CONFIG_CACHE_NO_STRING;
+    }
+    return (UINT32)(String - Table->Strings);
+}
+
+static VOID StoreRoot(CONFIG_CACHE_ROOT* Cached, BOOT_ROOT* Root) {
+    Cached->Type = Root->Type;
+    Cached->Partition = Root->Partition;
+    CopyGuid(&Cached->Guid, &Root->Guid);
+    CopyMem(&Cached->Server, &Root->Server, sizeof(EFI_IPv4_ADDRESS));
+}
+
+EFI_STATUS WriteConfigCache(EFI_FILE_PROTOCOL* Root, CHAR16* Path, EFI_FILE_INFO* Info, UINT64 Hash, BOOT_ENTRY_TABLE* Table, CONFIG_GLOBALS* Globals) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    EFI_FILE_PROTOCOL* File = NULL;
+    CONFIG_CACHE_HEADER* Header = NULL;
+
+    UINTN EntryCount = 0;
+    for (UINTN i = 0; i < Table->EntryCount; ++i) {
+        if (Table->Entries[i].EntryType == BOOT_ENTRY_KERNEL) {
+            EntryCount++;
+        }
+    }
+
+    UINTN Size = sizeof(CONFIG_CACHE_HEADER)
+        + EntryCount * sizeof(CONFIG_CACHE_ENTRY)
+        + Table->ModuleCount * sizeof(CONFIG_CACHE_MODULE)
+        + Table->StringsSize * sizeof(CHAR16);
+    Header = AllocateZeroPool(Size);
+    CHECK_ERROR(Header != NULL, EFI_OUT_OF_RESOURCES);
+
+    Header->Magic = CONFIG_CACHE_MAGIC;
+    Header->Version = CONFIG_CACHE_VERSION;
+    Header->SourceHash = Hash;
+    Header->SourceSize = Info->FileSize;
+    CopyMem(&Header->SourceTime, &Info->ModificationTime, sizeof(EFI_TIME));
+    Header->HasTimeout = Globals->HasTimeout;
+    Header->DisableTimer = Globals->DisableTimer;
+    Header->BootDelay = Globals->BootDelay;
+    Header->HasDefaultEntry = Globals->HasDefaultEntry;
+    Header->DefaultOS = Globals->DefaultOS;
+    Header->LogLevel = Globals->HasLogLevel ? Globals->LogLevel + 1 : 0;
+    Header->MenuKey = Globals->HasMenuKey ? Globals->MenuKey + 1 : 0;
+    Header->EntryCount = EntryCount;
+    Header->ModuleCount = Table->ModuleCount;
+    Header->StringsSize = Table->StringsSize;
+
+    CONFIG_CACHE_ENTRY* Entries = (CONFIG_CACHE_ENTRY*)(Header + 1);
+    CONFIG_CACHE_MODULE* Modules = (CONFIG_CACHE_MODULE*)(Entries + EntryCount);
+    CHAR16* Strings = (CHAR16*)(Modules + Table->ModuleCount);
+
+    CONFIG_CACHE_ENTRY* Entry = Entries;
+    for (UINTN i = 0; i < Table->EntryCount; ++i) {
+        if (Table->Entries[i].EntryType != BOOT_ENTRY_KERNEL) {
+            continue;
+        }
+
+        BOOT_KERNEL_ENTRY* Kernel = &Table->Entries[i].Kernel;
+        Entry->Protocol = Kernel->Protocol;
+        Entry->Name = StoreString(Table, Kernel->Name);
+        Entry->Path = StoreString(Table, Kernel->Path);
+        Entry->Cmdline = StoreString(Table, Kernel->Cmdline);
+        StoreRoot(&Entry->Root, &Kernel->Root);
+        Entry->ModuleCount = Kernel->ModuleCount;
+        Entry->HasSha256 = Kernel->HasSha256;
+        CopyMem(Entry->Sha256, Kernel->Sha256, SHA256_DIGEST_SIZE);
+        Entry->ModulesAbove4G = Kernel->ModulesAbove4G;
+
+        // The modules of the entries are stored in order
+        for (UINTN j = 0; j < Kernel->ModuleCount; ++j) {
+            BOOT_MODULE* Module = &Kernel->Modules[j];
+            StoreRoot(&Modules->Root, &Module->Root);
+            Modules->Path = StoreString(Table, Module->Path);
+            Modules->Tag = StoreString(Table, Module->Tag);
+            Modules->HasSha256 = Module->HasSha256;
+            CopyMem(Modules->Sha256, Module->Sha256, SHA256_DIGEST_SIZE);
+            Modules++;
+        }
+
+        Entry++;
+    }
+
+    CopyMem(Strings, Table->Strings, Table->StringsSize * sizeof(CHAR16));
+
+    // The boot filesystem may very well be read only, so don't complain
+    if (EFI_ERROR(Root->Open(Root, &File, Path, EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE | EFI_FILE_MODE_CREATE, 0))) {
+        File = NULL;
+        Status = EFI_WRITE_PROTECTED;
+        goto cleanup;
+    }
+
+    UINTN Written = Size;
+    EFI_CHECK(FileHandleWrite(File, &Written, Header));
+    CHECK_ERROR(Written == Size, EFI_VOLUME_FULL);
+
+    // Drop whatever was left over from an older cache
+    EFI_CHECK(FileHandleSetSize(File, Size));
+
+cleanup:
+    if (File != NULL) {
+        FileHandleClose(File);
+    }
+
+    if (Header != NULL) {
+        FreePool(Header);
+    }
+
+    return Status;
+}
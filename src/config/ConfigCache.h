@@ -0,0 +1,108 @@
+#pragma once
+
+#include "BootEntries.h"
+
+#include <Uefi.h>
+
+#include <Guid/FileInfo.h>
+#include <Protocol/SimpleFileSystem.h>
+
+// The global keys of the config, only the ones that are present override
+// the saved boot config
+typedef struct {
+    BOOLEAN HasTimeout;
+    BOOLEAN DisableTimer;
+    BOOLEAN HasDefaultEntry;
+    BOOLEAN HasLogLevel;
+    UINT8 LogLevel;
+    BOOLEAN HasMenuKey;
+    UINT8 MenuKey;
+    INT32 BootDelay;
+    INT32 DefaultOS;
+} CONFIG_GLOBALS;
+
+//
+// The compiled config is stored beside the text config, it is made of the
+// header, followed by the entries, the modules and finally the strings. It
+// can also be built ahead of time with gen_config_cache.py, which has to be
+// kept in sync with these structures.
+//
+
+#define CONFIG_CACHE_MAGIC SIGNATURE_32('R', 'L', 'C', 'C')
+#define CONFIG_CACHE_VERSION 5
+
+// Used as the string offset for empty strings
+#define CONFIG_CACHE_NO_STRING MAX_UINT32
+
+#pragma pack(1)
+
+typedef struct {
+    UINT32 Type;
+    UINT32 Partition;
+    EFI_GUID Guid;
+    EFI_IPv4_ADDRESS Server;
+} CONFIG_CACHE_ROOT;
+
+typedef struct {
+    UINT32 Protocol;
+    UINT32 Name; // Offsets into the strings, in characters
+    UINT32 Path;
+    UINT32 Cmdline;
+    CONFIG_CACHE_ROOT Root;
+    UINT32 ModuleCount;
+    UINT8 HasSha256;
+    UINT8 Sha256[SHA256_DIGEST_SIZE];
+    UINT8 ModulesAbove4G;
+} CONFIG_CACHE_ENTRY;
+
+typedef struct {
+    CONFIG_CACHE_ROOT Root;
+    UINT32 Path;
+    UINT32 Tag;
+    UINT8 HasSha256;
+    UINT8 Sha256[SHA256_DIGEST_SIZE];
+} CONFIG_CACHE_MODULE;
+
+typedef struct {
+    UINT32 Magic;
+    UINT32 Version;
+
+    // Describes the config this was compiled from, a zero time means that
+    // only the hash can be used to match it
+    UINT64 SourceHash;
+    UINT64 SourceSize;
+    EFI_TIME SourceTime;
+
+    UINT8 HasTimeout;
+    UINT8 DisableTimer;
+    UINT8 HasDefaultEntry;
+    UINT8 LogLevel; // Zero if not set, otherwise the level plus one
+    UINT8 MenuKey; // Zero if not set, otherwise the key plus one
+    UINT8 Reserved[3];
+    INT32 BootDelay;
+    INT32 DefaultOS;
+
+    UINT32 EntryCount;
+    UINT32 ModuleCount;
+    UINT32 StringsSize; // In characters
+} CONFIG_CACHE_HEADER;
+
+#pragma pack()
+
+// FNV-1a over the raw config file
+UINT64 HashConfig(const UINT8* Data, UINTN Size);
+
+// Reads and validates the cache, returns EFI_NOT_FOUND if there is none
+EFI_STATUS ReadConfigCache(EFI_FILE_PROTOCOL* Root, CHAR16* Path, CONFIG_CACHE_HEADER** Cache);
+
+// Checks whether the cache was compiled from the given config by its
+// contents, and whether the time it recorded is still the current one
+BOOLEAN ConfigCacheTimeMatches(CONFIG_CACHE_HEADER* Cache, EFI_FILE_INFO* Info);
+BOOLEAN ConfigCacheHashMatches(CONFIG_CACHE_HEADER* Cache, UINT64 Size, UINT64 Hash);
+
+// Builds the entry table from the cache, leaving room for ExtraEntries more
+// entries. The filesystems of the entries are left unresolved.
+EFI_STATUS LoadConfigCache(CONFIG_CACHE_HEADER* Cache, BOOT_ENTRY_TABLE* Table, UINTN ExtraEntries, CONFIG_GLOBALS* Globals);
+
+// Compiles the kernel entries of the table into a cache file
+EFI_STATUS WriteConfigCache(EFI_FILE_PROTOCOL* Root, CHAR16* Path, EFI_FILE_INFO* Info, UINT64 Hash, BOOT_ENTRY_TABLE* Table, CONFIG_GLOBALS* Globals);
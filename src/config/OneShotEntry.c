@@ -0,0 +1,28 @@
+#include "OneShotEntry.h"
+
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UefiLib.h>
+#include <Library/UefiRuntimeServicesTableLib.h>
+
+static EFI_GUID mLoaderInterfaceGuid = LOADER_INTERFACE_GUID;
+
+CHAR16* TakeOneShotEntry(VOID) {
+    CHAR16* Name = NULL;
+    UINTN Size = 0;
+
+    if (EFI_ERROR(GetVariable2(L"LoaderEntryOneShot", &mLoaderInterfaceGuid, (VOID**)&Name, &Size))) {
+        return NULL;
+    }
+
+    // Delete it before anything else, if the entry doesn't boot the next
+    // boot should go back to the default one
+    gRT->SetVariable(L"LoaderEntryOneShot", &mLoaderInterfaceGuid, 0, 0, NULL);
+
+    // Has to be a non-empty, terminated string
+    if (Size < 2 * sizeof(CHAR16) || Size % sizeof(CHAR16) != 0 || Name[Size / sizeof(CHAR16) - 1] != CHAR_NULL) {
+        FreePool(Name);
+        return NULL;
+    }
+
+    return Name;
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <Uefi.h>
+
+// The vendor GUID of the Boot Loader Interface variables, which the OS side
+// tools (bootctl, systemctl reboot --boot-loader-entry) already write
+#define LOADER_INTERFACE_GUID \
+    { 0x4a67b082, 0x0a4c, 0x41cf, { 0xb6, 0xc7, 0x44, 0x0b, 0x29, 0xbb, 0x8c, 0x4f } }
+
+// Reads and deletes LoaderEntryOneShot, so the entry is only ever tried
+// once. Returns the name of the entry, to be freed by the caller, or NULL if
+// there is none.
+CHAR16* TakeOneShotEntry(VOID);
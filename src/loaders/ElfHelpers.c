@@ -4,6 +4,7 @@
 #include <Library/UefiBootServicesTableLib.h>
 #include <util/Except.h>
 #include <util/FileUtils.h>
+#include <util/MemTrack.h>
 #include <util/MemUtils.h>
 
 #include <ElfLib/ElfLibInternal.h>
@@ -93,10 +94,11 @@ cleanup:
     return Status;
 }
 
-EFI_STATUS LoadElf(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* Fs, CHAR16* Path, UINTN* Base, UINTN* Size) {
+EFI_STATUS LoadElf(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* Fs, CHAR16* Path, const UINT8* Sha256, EFI_MEMORY_TYPE MemoryType, UINTN* Base, UINTN* Size) {
     EFI_STATUS Status = EFI_SUCCESS;
     EFI_FILE_PROTOCOL* root = NULL;
     EFI_FILE_PROTOCOL* moduleImage = NULL;
+    BOOLEAN Allocated = FALSE;
 
     CHECK(Fs != NULL);
     CHECK(Path != NULL);
@@ -104,10 +106,11 @@ EFI_STATUS LoadElf(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* Fs, CHAR16* Path, UINTN* Bas
     EFI_CHECK(Fs->OpenVolume(Fs, &root));
     EFI_CHECK(root->Open(root, &moduleImage, Path, EFI_FILE_MODE_READ, 0));
 
-    *Base = BASE_4GB - *Size - 1;
     EFI_CHECK(FileHandleGetSize(moduleImage, Size));
-    EFI_CHECK(gBS->AllocatePages(AllocateMaxAddress, gKernelAndModulesMemoryType, EFI_SIZE_TO_PAGES(*Size), Base));
-    CHECK_AND_RETHROW(FileRead(moduleImage, (void*)*Base, *Size, 0));
+    *Base = BASE_4GB - 1;
+    EFI_CHECK(TrackedAllocatePages(MEM_TAG_FILES, AllocateMaxAddress, MemoryType, EFI_SIZE_TO_PAGES(*Size), Base));
+    Allocated = TRUE;
+    CHECK_AND_RETHROW(FileReadVerified(moduleImage, (void*)*Base, *Size, 0, Sha256));
 
 cleanup:
     if (root != NULL) {
@@ -118,8 +121,8 @@ cleanup:
         FileHandleClose(moduleImage);
     }
 
-    if (EFI_ERROR(Status) && Base != NULL && Size != NULL) {
-        gBS->FreePages(*Base, EFI_SIZE_TO_PAGES(*Size));
+    if (EFI_ERROR(Status) && Allocated) {
+        TrackedFreePages(MEM_TAG_FILES, *Base, EFI_SIZE_TO_PAGES(*Size));
     }
 
     return Status;
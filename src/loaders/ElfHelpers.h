@@ -13,4 +13,7 @@
 #include <ElfLib/Elf64.h>
 
 EFI_STATUS ElfLookupSymbol(UINT8* ImageBase, CHAR8* TargetSymbolName, CHAR8 SymbolType, Elf64_Sym** Symbol);
-EFI_STATUS LoadElf(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* Fs, CHAR16* Path, UINTN* Base, UINTN* Size);
+
+// Sha256 is optional, the image is refused if it doesn't match. The memory
+// type is picked the same way as for LoadBootModule.
+EFI_STATUS LoadElf(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* Fs, CHAR16* Path, const UINT8* Sha256, EFI_MEMORY_TYPE MemoryType, UINTN* Base, UINTN* Size);
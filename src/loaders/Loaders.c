@@ -1,14 +1,18 @@
 #include "Loaders.h"
+#include <Library/BaseMemoryLib.h>
 #include <Library/FileHandleLib.h>
 #include <Library/MemoryAllocationLib.h>
 #include <Library/UefiBootServicesTableLib.h>
+#include <util/DrawUtils.h>
 #include <util/FileUtils.h>
+#include <util/MemTrack.h>
 #include <util/MemUtils.h>
 
-EFI_STATUS LoadBootModule(BOOT_MODULE* Module, UINTN* Base, UINTN* Size) {
+EFI_STATUS LoadBootModule(BOOT_MODULE* Module, EFI_MEMORY_TYPE MemoryType, EFI_PHYSICAL_ADDRESS MaxAddress, UINTN* Base, UINTN* Size) {
     EFI_STATUS Status = EFI_SUCCESS;
     EFI_FILE_PROTOCOL* root = NULL;
     EFI_FILE_PROTOCOL* moduleImage = NULL;
+    BOOLEAN Allocated = FALSE;
 
     CHECK(Module != NULL);
     CHECK(Module->Fs != NULL);
@@ -17,10 +21,11 @@ EFI_STATUS LoadBootModule(BOOT_MODULE* Module, UINTN* Base, UINTN* Size) {
     EFI_CHECK(Module->Fs->OpenVolume(Module->Fs, &root));
     EFI_CHECK(root->Open(root, &moduleImage, Module->Path, EFI_FILE_MODE_READ, 0));
 
-    *Base = BASE_4GB;
+    *Base = MaxAddress;
     EFI_CHECK(FileHandleGetSize(moduleImage, Size));
-    EFI_CHECK(gBS->AllocatePages(AllocateMaxAddress, gKernelAndModulesMemoryType, EFI_SIZE_TO_PAGES(*Size), Base));
-    CHECK_AND_RETHROW(FileRead(moduleImage, (void*)*Base, *Size, 0));
+    EFI_CHECK(TrackedAllocatePages(MEM_TAG_FILES, AllocateMaxAddress, MemoryType, EFI_SIZE_TO_PAGES(*Size), Base));
+    Allocated = TRUE;
+    CHECK_AND_RETHROW(FileReadVerified(moduleImage, (void*)*Base, *Size, 0, Module->HasSha256 ? Module->Sha256 : NULL));
 
 cleanup:
     if (root != NULL) {
@@ -31,8 +36,72 @@ cleanup:
         FileHandleClose(moduleImage);
     }
 
-    if (EFI_ERROR(Status) && Base != NULL && Size != NULL) {
-        gBS->FreePages(*Base, EFI_SIZE_TO_PAGES(*Size));
+    if (EFI_ERROR(Status) && Allocated) {
+        TrackedFreePages(MEM_TAG_FILES, *Base, EFI_SIZE_TO_PAGES(*Size));
+    }
+
+    return Status;
+}
+
+static EFI_GUID mDigestTableGuid = RAINLOADER_DIGEST_TABLE_GUID;
+static RAINLOADER_DIGEST_TABLE* mDigestTable = NULL;
+
+static VOID AddDigest(RAINLOADER_DIGEST_TABLE* Table, UINT32 Kind, UINT32 Index, UINT8* Sha256) {
+    RAINLOADER_DIGEST* Digest = &Table->Digests[Table->Count++];
+    Digest->Kind = Kind;
+    Digest->Index = Index;
+    CopyMem(Digest->Sha256, Sha256, SHA256_DIGEST_SIZE);
+}
+
+// Lets the kernel know which of its files were checked, and against what.
+// The files are refused on a mismatch, so by the time the kernel runs these
+// are also the digests of what it was given.
+static EFI_STATUS InstallDigestTable(BOOT_KERNEL_ENTRY* Entry) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    RAINLOADER_DIGEST_TABLE* Table = NULL;
+
+    UINTN Count = Entry->HasSha256 ? 1 : 0;
+    for (UINTN i = 0; i < Entry->ModuleCount; ++i) {
+        if (Entry->Modules[i].HasSha256) {
+            Count++;
+        }
+    }
+
+    // Don't leave the table of an entry that failed to boot around
+    if (Count == 0) {
+        if (mDigestTable != NULL) {
+            gBS->InstallConfigurationTable(&mDigestTableGuid, NULL);
+            FreePool(mDigestTable);
+            mDigestTable = NULL;
+        }
+        goto cleanup;
+    }
+
+    // The kernel may want to look at this after exiting boot services
+    UINTN Size = sizeof(RAINLOADER_DIGEST_TABLE) + Count * sizeof(RAINLOADER_DIGEST);
+    EFI_CHECK(gBS->AllocatePool(EfiACPIReclaimMemory, Size, (VOID**)&Table));
+    Table->Version = RAINLOADER_DIGEST_TABLE_VERSION;
+    Table->Count = 0;
+
+    if (Entry->HasSha256) {
+        AddDigest(Table, RAINLOADER_DIGEST_KERNEL, 0, Entry->Sha256);
+    }
+    for (UINTN i = 0; i < Entry->ModuleCount; ++i) {
+        if (Entry->Modules[i].HasSha256) {
+            AddDigest(Table, RAINLOADER_DIGEST_MODULE, i, Entry->Modules[i].Sha256);
+        }
+    }
+
+    EFI_CHECK(gBS->InstallConfigurationTable(&mDigestTableGuid, Table));
+    if (mDigestTable != NULL) {
+        FreePool(mDigestTable);
+    }
+    mDigestTable = Table;
+    Table = NULL;
+
+cleanup:
+    if (Table != NULL) {
+        FreePool(Table);
     }
 
     return Status;
@@ -43,6 +112,13 @@ EFI_STATUS LoadKernel(BOOT_KERNEL_ENTRY* Entry) {
 
     CHECK(Entry != NULL);
 
+    // Only now look up the filesystems the entry lives on
+    CHECK_AND_RETHROW(ResolveBootEntry(Entry));
+    CHECK_AND_RETHROW(InstallDigestTable(Entry));
+
+    // The loaders draw straight to the framebuffer and may change its mode
+    DisableBackBuffer();
+
     switch (Entry->Protocol) {
         case BOOT_LINUX:
             CHECK_AND_RETHROW(LoadLinuxKernel(Entry));
@@ -52,6 +128,14 @@ EFI_STATUS LoadKernel(BOOT_KERNEL_ENTRY* Entry) {
             CHECK_AND_RETHROW(LoadMB2Kernel(Entry));
             break;
 
+        case BOOT_LINUX_EFI:
+            CHECK_AND_RETHROW(LoadLinuxEfiKernel(Entry));
+            break;
+
+        case BOOT_LIMINE:
+            CHECK_AND_RETHROW(LoadLimineKernel(Entry));
+            break;
+
         default:
             CHECK_FAIL_TRACE("Unknown boot protocol");
     }
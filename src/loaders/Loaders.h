@@ -7,9 +7,45 @@
 
 #include <Protocol/SimpleFileSystem.h>
 
-EFI_STATUS LoadBootModule(BOOT_MODULE* Module, UINTN* Base, UINTN* Size);
+//
+// The digests of the files that were verified on load are passed to the
+// kernel in an EFI configuration table
+//
+
+#define RAINLOADER_DIGEST_TABLE_GUID \
+    { 0xdd968255, 0x69c6, 0x4b53, { 0x9c, 0xf5, 0xe0, 0x31, 0x3f, 0xef, 0x4b, 0xc6 } }
+
+#define RAINLOADER_DIGEST_TABLE_VERSION 1
+
+#define RAINLOADER_DIGEST_KERNEL 0
+#define RAINLOADER_DIGEST_MODULE 1
+
+#pragma pack(1)
+
+typedef struct {
+    UINT32 Kind;
+    UINT32 Index; // Of the module within the entry
+    UINT8 Sha256[SHA256_DIGEST_SIZE];
+} RAINLOADER_DIGEST;
+
+typedef struct {
+    UINT32 Version;
+    UINT32 Count;
+    RAINLOADER_DIGEST Digests[];
+} RAINLOADER_DIGEST_TABLE;
+
+#pragma pack()
+
+// Reads the module to the highest free pages below MaxAddress, which keeps
+// low memory free for whatever can't live anywhere else. Refuses the module
+// if it has a SHA256 and it doesn't match. Files that are handed to the
+// kernel as they are go in gKernelAndModulesMemoryType, the rest in
+// LOADER_SCRATCH_MEMORY_TYPE.
+EFI_STATUS LoadBootModule(BOOT_MODULE* Module, EFI_MEMORY_TYPE MemoryType, EFI_PHYSICAL_ADDRESS MaxAddress, UINTN* Base, UINTN* Size);
 
 EFI_STATUS LoadLinuxKernel(BOOT_KERNEL_ENTRY* Entry);
 EFI_STATUS LoadMB2Kernel(BOOT_KERNEL_ENTRY* Entry);
+EFI_STATUS LoadLinuxEfiKernel(BOOT_KERNEL_ENTRY* Entry);
+EFI_STATUS LoadLimineKernel(BOOT_KERNEL_ENTRY* Entry);
 
 EFI_STATUS LoadKernel(BOOT_KERNEL_ENTRY* Entry);
@@ -0,0 +1,479 @@
+#include "limine.h"
+
+#include <Uefi.h>
+
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+
+#include <config/BootConfig.h>
+#include <config/BootEntries.h>
+#include <loaders/ElfHelpers.h>
+#include <loaders/Loaders.h>
+#include <util/DrawUtils.h>
+#include <util/Except.h>
+#include <util/GfxUtils.h>
+#include <util/Halt.h>
+#include <util/Log.h>
+#include <util/MemTrack.h>
+#include <util/MemUtils.h>
+#include <util/PageTables.h>
+#include <util/WorkPool.h>
+
+#include <ElfLib.h>
+#include <ElfLib/ElfCommon.h>
+
+#include <ElfLib/Elf64.h>
+
+// Anything below this can't be reached with the kernel code model
+#define LIMINE_KERNEL_MIN_ADDRESS 0xFFFFFFFF80000000ull
+
+#define LIMINE_STACK_SIZE SIZE_64KB
+
+// The newest base revision we know, past that the kernel is told that its
+// revision isn't supported
+#define LIMINE_SUPPORTED_BASE_REVISION 1
+
+// Optional, marks the end of the requests so the rest of the image doesn't
+// have to be scanned
+#define LIMINE_REQUESTS_END_MARKER_0 0xadc0e0531bb10d03ull
+#define LIMINE_REQUESTS_END_MARKER_1 0x9572709f31764c62ull
+
+#define HHDM(Address) ((UINT64)(UINTN)(Address) + HIGHER_HALF_OFFSET)
+
+extern void JumpToLimineKernel(UINT64 Entry, UINT64 Stack, UINT64* Pml4);
+
+typedef enum {
+    REQUEST_BOOTLOADER_INFO,
+    REQUEST_HHDM,
+    REQUEST_FRAMEBUFFER,
+    REQUEST_MEMMAP,
+    REQUEST_KERNEL_FILE,
+    REQUEST_MODULE,
+    REQUEST_KERNEL_ADDRESS,
+    REQUEST_COUNT,
+} LIMINE_REQUEST_TYPE;
+
+static const UINT64 mRequestIds[REQUEST_COUNT][4] = {
+    [REQUEST_BOOTLOADER_INFO] = LIMINE_BOOTLOADER_INFO_REQUEST,
+    [REQUEST_HHDM] = LIMINE_HHDM_REQUEST,
+    [REQUEST_FRAMEBUFFER] = LIMINE_FRAMEBUFFER_REQUEST,
+    [REQUEST_MEMMAP] = LIMINE_MEMMAP_REQUEST,
+    [REQUEST_KERNEL_FILE] = LIMINE_KERNEL_FILE_REQUEST,
+    [REQUEST_MODULE] = LIMINE_MODULE_REQUEST,
+    [REQUEST_KERNEL_ADDRESS] = LIMINE_KERNEL_ADDRESS_REQUEST,
+};
+
+static UINT64 EfiTypeToLimineType[] = {
+    [EfiReservedMemoryType] = LIMINE_MEMMAP_RESERVED,
+    [EfiLoaderCode] = LIMINE_MEMMAP_BOOTLOADER_RECLAIMABLE,
+    [EfiLoaderData] = LIMINE_MEMMAP_BOOTLOADER_RECLAIMABLE,
+    [EfiBootServicesCode] = LIMINE_MEMMAP_USABLE,
+    [EfiBootServicesData] = LIMINE_MEMMAP_USABLE,
+    [EfiRuntimeServicesCode] = LIMINE_MEMMAP_RESERVED,
+    [EfiRuntimeServicesData] = LIMINE_MEMMAP_RESERVED,
+    [EfiConventionalMemory] = LIMINE_MEMMAP_USABLE,
+    [EfiUnusableMemory] = LIMINE_MEMMAP_BAD_MEMORY,
+    [EfiACPIReclaimMemory] = LIMINE_MEMMAP_ACPI_RECLAIMABLE,
+    [EfiACPIMemoryNVS] = LIMINE_MEMMAP_ACPI_NVS,
+    [EfiMemoryMappedIO] = LIMINE_MEMMAP_RESERVED,
+    [EfiMemoryMappedIOPortSpace] = LIMINE_MEMMAP_RESERVED,
+    [EfiPalCode] = LIMINE_MEMMAP_RESERVED,
+};
+
+// A range whose type we know better than the firmware does
+typedef struct {
+    UINT64 Base;
+    UINT64 Length;
+    UINT64 Type;
+    MEM_TAG Tag; // Of the allocation, if the range was allocated here
+} LIMINE_RANGE;
+
+typedef struct {
+    struct limine_memmap_entry* Entries;
+    UINTN Count;
+    UINTN Capacity;
+} LIMINE_MEMMAP;
+
+static VOID FindRequests(UINT8* Image, UINTN Size, struct limine_request** Requests) {
+    // Requests are 8 byte aligned anywhere in the image
+    for (UINTN Offset = 0; Offset + sizeof(struct limine_request) <= Size; Offset += sizeof(UINT64)) {
+        UINT64* Words = (UINT64*)(Image + Offset);
+
+        if (Words[0] == LIMINE_REQUESTS_END_MARKER_0 && Words[1] == LIMINE_REQUESTS_END_MARKER_1) {
+            break;
+        }
+
+        if (Words[0] == LIMINE_BASE_REVISION_MAGIC_0 && Words[1] == LIMINE_BASE_REVISION_MAGIC_1) {
+            // Zeroed to let the kernel know we went with its revision
+            if (Words[2] <= LIMINE_SUPPORTED_BASE_REVISION) {
+                Words[2] = 0;
+            }
+            continue;
+        }
+
+        for (UINTN i = 0; i < REQUEST_COUNT; ++i) {
+            if (CompareMem(Words, mRequestIds[i], sizeof(mRequestIds[i])) == 0) {
+                Requests[i] = (struct limine_request*)Words;
+                break;
+            }
+        }
+    }
+}
+
+// Everything the kernel is handed is loader data, which it only reclaims
+// once it is done with it. The pool would be boot services data, which is
+// reported as usable.
+static VOID* AllocateBootInfo(UINTN Size) {
+    VOID* Buffer = NULL;
+    if (EFI_ERROR(gBS->AllocatePool(EfiLoaderData, Size, &Buffer))) {
+        return NULL;
+    }
+
+    ZeroMem(Buffer, Size);
+    TrackAllocation(MEM_TAG_BOOT_INFO, Size);
+    return Buffer;
+}
+
+static VOID* AllocateResponse(struct limine_request* Request, UINTN Size) {
+    VOID* Response = AllocateBootInfo(Size);
+    if (Response != NULL) {
+        Request->response = HHDM(Response);
+    }
+    return Response;
+}
+
+static CHAR8* ToAscii(CHAR16* String) {
+    UINTN Size = StrLen(String) + 1;
+    CHAR8* Ascii = AllocateBootInfo(Size);
+    if (Ascii != NULL) {
+        UnicodeStrToAsciiStrS(String, Ascii, Size);
+    }
+    return Ascii;
+}
+
+// The kernel sees the paths the way they are written in the config
+static CHAR8* ToAsciiPath(CHAR16* Path) {
+    UINTN Length = StrLen(Path);
+    CHAR8* Ascii = AllocateBootInfo(Length + 2);
+    if (Ascii == NULL) {
+        return NULL;
+    }
+
+    Ascii[0] = '/';
+    for (UINTN i = 0; i < Length; ++i) {
+        Ascii[i + 1] = Path[i] == L'\\' ? '/' : (CHAR8)Path[i];
+    }
+    Ascii[Length + 1] = '\0';
+    return Ascii;
+}
+
+static EFI_STATUS FillFile(struct limine_file* File, UINT64 Base, UINT64 Size, BOOT_ROOT* Root, CHAR16* Path, CHAR16* Cmdline) {
+    EFI_STATUS Status = EFI_SUCCESS;
+
+    CHAR8* AsciiPath = ToAsciiPath(Path);
+    CHECK_ERROR(AsciiPath != NULL, EFI_OUT_OF_RESOURCES);
+    CHAR8* AsciiCmdline = ToAscii(Cmdline);
+    CHECK_ERROR(AsciiCmdline != NULL, EFI_OUT_OF_RESOURCES);
+
+    File->address = HHDM(Base);
+    File->size = Size;
+    File->path = HHDM(AsciiPath);
+    File->cmdline = HHDM(AsciiCmdline);
+    File->media_type = LIMINE_MEDIA_TYPE_GENERIC;
+    if (Root->Type == BOOT_ROOT_TFTP) {
+        File->media_type = LIMINE_MEDIA_TYPE_TFTP;
+        CopyMem(&File->tftp_ip, &Root->Server, sizeof(File->tftp_ip));
+    }
+
+cleanup:
+    return Status;
+}
+
+static VOID AddMemmapEntry(LIMINE_MEMMAP* Memmap, UINT64 Base, UINT64 Length, UINT64 Type) {
+    if (Memmap->Count < Memmap->Capacity) {
+        Memmap->Entries[Memmap->Count++] = (struct limine_memmap_entry){ Base, Length, Type };
+    }
+}
+
+// Carves the range out of whatever entries it overlaps and gives it its own
+static VOID SetMemmapRange(LIMINE_MEMMAP* Memmap, LIMINE_RANGE* Range) {
+    UINT64 End = Range->Base + Range->Length;
+
+    UINTN Count = Memmap->Count;
+    for (UINTN i = 0; i < Count; ++i) {
+        struct limine_memmap_entry* Entry = &Memmap->Entries[i];
+        UINT64 EntryEnd = Entry->base + Entry->length;
+        if (EntryEnd <= Range->Base || Entry->base >= End) {
+            continue;
+        }
+
+        if (EntryEnd > End) {
+            AddMemmapEntry(Memmap, End, EntryEnd - End, Entry->type);
+        }
+        Entry->length = Entry->base < Range->Base ? Range->Base - Entry->base : 0;
+    }
+
+    AddMemmapEntry(Memmap, Range->Base, Range->Length, Range->Type);
+}
+
+// Runs after boot services are gone, so it only uses what was allocated up
+// front. The entries have to be sorted and must not overlap.
+static VOID BuildMemmap(LIMINE_MEMMAP* Memmap, EFI_MEMORY_DESCRIPTOR* MemoryMap, UINTN MemoryMapSize, UINTN DescriptorSize, LIMINE_RANGE* Ranges, UINTN RangeCount) {
+    for (UINTN i = 0; i < MemoryMapSize / DescriptorSize; ++i) {
+        EFI_MEMORY_DESCRIPTOR* Desc = (EFI_MEMORY_DESCRIPTOR*)((UINT8*)MemoryMap + i * DescriptorSize);
+        UINT64 Type = Desc->Type < ARRAY_SIZE(EfiTypeToLimineType) ? EfiTypeToLimineType[Desc->Type] : LIMINE_MEMMAP_RESERVED;
+        AddMemmapEntry(Memmap, Desc->PhysicalStart, EFI_PAGES_TO_SIZE(Desc->NumberOfPages), Type);
+    }
+
+    for (UINTN i = 0; i < RangeCount; ++i) {
+        SetMemmapRange(Memmap, &Ranges[i]);
+    }
+
+    for (UINTN i = 1; i < Memmap->Count; ++i) {
+        struct limine_memmap_entry Entry = Memmap->Entries[i];
+        UINTN j = i;
+        for (; j > 0 && Memmap->Entries[j - 1].base > Entry.base; --j) {
+            Memmap->Entries[j] = Memmap->Entries[j - 1];
+        }
+        Memmap->Entries[j] = Entry;
+    }
+
+    // Drop what was carved away and merge neighbours of the same type
+    UINTN Count = 0;
+    for (UINTN i = 0; i < Memmap->Count; ++i) {
+        struct limine_memmap_entry* Entry = &Memmap->Entries[i];
+        if (Entry->length == 0) {
+            continue;
+        }
+
+        struct limine_memmap_entry* Last = Count != 0 ? &Memmap->Entries[Count - 1] : NULL;
+        if (Last != NULL && Last->type == Entry->type && Last->base + Last->length == Entry->base) {
+            Last->length += Entry->length;
+        } else {
+            Memmap->Entries[Count++] = *Entry;
+        }
+    }
+    Memmap->Count = Count;
+}
+
+/**
+ * Loads the kernel at the virtual addresses it was linked at, serves the
+ * requests it has in its image, and enters it in long mode with page tables
+ * that already have the higher half direct map, so that the kernel doesn't
+ * have to build its own right away.
+ */
+EFI_STATUS LoadLimineKernel(BOOT_KERNEL_ENTRY* Entry) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    UINT8* Elf = NULL;
+    UINTN ElfSize = 0;
+    EFI_PHYSICAL_ADDRESS KernelBase = 0;
+    UINTN KernelPages = 0;
+    LIMINE_RANGE* Ranges = NULL;
+    UINTN RangeCount = 0;
+    EFI_MEMORY_DESCRIPTOR* MemoryMap = NULL;
+    struct limine_request* Requests[REQUEST_COUNT] = {};
+
+    BOOT_CONFIG config;
+    LoadBootConfig(&config);
+    EFI_CHECK(SetGfxMode(config.GfxMode));
+
+    // The kernel, its file, the modules and the framebuffer
+    Ranges = AllocateZeroPool((3 + Entry->ModuleCount) * sizeof(LIMINE_RANGE));
+    CHECK_ERROR(Ranges != NULL, EFI_OUT_OF_RESOURCES);
+
+    TRACE("Loading kernel image");
+    CHECK_AND_RETHROW(LoadElf(Entry->Fs, Entry->Path, Entry->HasSha256 ? Entry->Sha256 : NULL, gKernelAndModulesMemoryType, (UINTN*)&Elf, &ElfSize));
+    Ranges[RangeCount++] = (LIMINE_RANGE){ (UINTN)Elf, ALIGN_VALUE(ElfSize, EFI_PAGE_SIZE), LIMINE_MEMMAP_KERNEL_AND_MODULES, MEM_TAG_FILES };
+
+    ELF_IMAGE_CONTEXT Context;
+    ZeroMem(&Context, sizeof(Context));
+    CHECK_AND_RETHROW(ParseElfImage(Elf, &Context));
+    CHECK_TRACE(Context.EiClass == ELFCLASS64, "Limine kernels have to be 64-bit");
+
+    // The segments are loaded as one block, which is mapped where the
+    // kernel was linked
+    Elf64_Ehdr* Ehdr = (Elf64_Ehdr*)Elf;
+    UINT64 VirtualBase = MAX_UINT64;
+    UINT64 VirtualEnd = 0;
+    for (UINT32 i = 0; i < Ehdr->e_phnum; ++i) {
+        Elf64_Phdr* Phdr = (Elf64_Phdr*)(Elf + Ehdr->e_phoff + i * Ehdr->e_phentsize);
+        if (Phdr->p_type == PT_LOAD) {
+            VirtualBase = MIN(VirtualBase, Phdr->p_vaddr & ~(UINT64)EFI_PAGE_MASK);
+            VirtualEnd = MAX(VirtualEnd, ALIGN_VALUE(Phdr->p_vaddr + Phdr->p_memsz, EFI_PAGE_SIZE));
+        }
+    }
+    CHECK_TRACE(VirtualBase < VirtualEnd, "The kernel has nothing to load");
+    CHECK_TRACE(VirtualBase >= LIMINE_KERNEL_MIN_ADDRESS, "The kernel has to be linked in the top 2GB");
+
+    KernelPages = EFI_SIZE_TO_PAGES(VirtualEnd - VirtualBase);
+    KernelBase = MAX_ADDRESS;
+    EFI_CHECK(TrackedAllocatePages(MEM_TAG_KERNEL, AllocateMaxAddress, gKernelAndModulesMemoryType, KernelPages, &KernelBase));
+    Ranges[RangeCount++] = (LIMINE_RANGE){ KernelBase, EFI_PAGES_TO_SIZE(KernelPages), LIMINE_MEMMAP_KERNEL_AND_MODULES, MEM_TAG_KERNEL };
+
+    ZeroMem((VOID*)(UINTN)KernelBase, EFI_PAGES_TO_SIZE(KernelPages));
+    for (UINT32 i = 0; i < Ehdr->e_phnum; ++i) {
+        Elf64_Phdr* Phdr = (Elf64_Phdr*)(Elf + Ehdr->e_phoff + i * Ehdr->e_phentsize);
+        if (Phdr->p_type == PT_LOAD) {
+            CHECK(Phdr->p_filesz <= Phdr->p_memsz && Phdr->p_offset + Phdr->p_filesz <= ElfSize);
+            ParallelCopyMem((UINT8*)(UINTN)KernelBase + (Phdr->p_vaddr - VirtualBase), Elf + Phdr->p_offset, Phdr->p_filesz);
+        }
+    }
+    TRACE("Loaded the kernel to %p", KernelBase);
+
+    FindRequests((UINT8*)(UINTN)KernelBase, EFI_PAGES_TO_SIZE(KernelPages), Requests);
+
+    if (Requests[REQUEST_BOOTLOADER_INFO] != NULL) {
+        struct limine_bootloader_info_response* Response = AllocateResponse(Requests[REQUEST_BOOTLOADER_INFO], sizeof(*Response));
+        CHECK_ERROR(Response != NULL, EFI_OUT_OF_RESOURCES);
+        Response->name = HHDM("RainLoader");
+        Response->version = HHDM("1");
+    }
+
+    if (Requests[REQUEST_HHDM] != NULL) {
+        struct limine_hhdm_response* Response = AllocateResponse(Requests[REQUEST_HHDM], sizeof(*Response));
+        CHECK_ERROR(Response != NULL, EFI_OUT_OF_RESOURCES);
+        Response->offset = HIGHER_HALF_OFFSET;
+    }
+
+    if (Requests[REQUEST_KERNEL_ADDRESS] != NULL) {
+        struct limine_kernel_address_response* Response = AllocateResponse(Requests[REQUEST_KERNEL_ADDRESS], sizeof(*Response));
+        CHECK_ERROR(Response != NULL, EFI_OUT_OF_RESOURCES);
+        Response->physical_base = KernelBase;
+        Response->virtual_base = VirtualBase;
+    }
+
+    // The command line only gets to the kernel through its file
+    if (Requests[REQUEST_KERNEL_FILE] != NULL) {
+        struct limine_kernel_file_response* Response = AllocateResponse(Requests[REQUEST_KERNEL_FILE], sizeof(*Response));
+        CHECK_ERROR(Response != NULL, EFI_OUT_OF_RESOURCES);
+        struct limine_file* File = AllocateBootInfo(sizeof(*File));
+        CHECK_ERROR(File != NULL, EFI_OUT_OF_RESOURCES);
+        CHECK_AND_RETHROW(FillFile(File, (UINTN)Elf, ElfSize, &Entry->Root, Entry->Path, Entry->Cmdline));
+        Response->kernel_file = HHDM(File);
+    }
+
+    // Loaded even if the kernel doesn't ask, so that they are still verified
+    struct limine_file* Files = AllocateBootInfo(Entry->ModuleCount * sizeof(struct limine_file));
+    UINT64* FilePointers = AllocateBootInfo(Entry->ModuleCount * sizeof(UINT64));
+    CHECK_ERROR(Files != NULL && FilePointers != NULL, EFI_OUT_OF_RESOURCES);
+    for (UINTN i = 0; i < Entry->ModuleCount; ++i) {
+        BOOT_MODULE* Module = &Entry->Modules[i];
+        UINTN Base = 0;
+        UINTN Size = 0;
+
+        CHECK_AND_RETHROW(LoadBootModule(Module, gKernelAndModulesMemoryType, MAX_ADDRESS, &Base, &Size));
+        Ranges[RangeCount++] = (LIMINE_RANGE){ Base, ALIGN_VALUE(Size, EFI_PAGE_SIZE), LIMINE_MEMMAP_KERNEL_AND_MODULES, MEM_TAG_FILES };
+        CHECK_AND_RETHROW(FillFile(&Files[i], Base, Size, &Module->Root, Module->Path, Module->Tag));
+        FilePointers[i] = HHDM(&Files[i]);
+        TRACE("    Added %s (%s) -> %p - %p", Module->Tag, Module->Path, Base, Base + Size);
+    }
+
+    if (Requests[REQUEST_MODULE] != NULL) {
+        struct limine_module_response* Response = AllocateResponse(Requests[REQUEST_MODULE], sizeof(*Response));
+        CHECK_ERROR(Response != NULL, EFI_OUT_OF_RESOURCES);
+        Response->module_count = Entry->ModuleCount;
+        Response->modules = HHDM(FilePointers);
+    }
+
+    UINT64 FramebufferBase = gop->Mode->FrameBufferBase & ~(UINT64)EFI_PAGE_MASK;
+    UINT64 FramebufferEnd = ALIGN_VALUE(gop->Mode->FrameBufferBase + gop->Mode->FrameBufferSize, EFI_PAGE_SIZE);
+    Ranges[RangeCount++] = (LIMINE_RANGE){ FramebufferBase, FramebufferEnd - FramebufferBase, LIMINE_MEMMAP_FRAMEBUFFER };
+
+    if (Requests[REQUEST_FRAMEBUFFER] != NULL) {
+        struct limine_framebuffer_response* Response = AllocateResponse(Requests[REQUEST_FRAMEBUFFER], sizeof(*Response));
+        CHECK_ERROR(Response != NULL, EFI_OUT_OF_RESOURCES);
+        struct limine_framebuffer* Framebuffer = AllocateBootInfo(sizeof(*Framebuffer));
+        UINT64* FramebufferPointer = AllocateBootInfo(sizeof(UINT64));
+        CHECK_ERROR(Framebuffer != NULL && FramebufferPointer != NULL, EFI_OUT_OF_RESOURCES);
+
+        Framebuffer->address = HHDM(gop->Mode->FrameBufferBase);
+        Framebuffer->width = gop->Mode->Info->HorizontalResolution;
+        Framebuffer->height = gop->Mode->Info->VerticalResolution;
+        Framebuffer->pitch = gop->Mode->Info->PixelsPerScanLine * 4;
+        Framebuffer->bpp = 32;
+        Framebuffer->memory_model = LIMINE_FRAMEBUFFER_RGB;
+        Framebuffer->red_mask_size = 8;
+        Framebuffer->red_mask_shift = 16;
+        Framebuffer->green_mask_size = 8;
+        Framebuffer->green_mask_shift = 8;
+        Framebuffer->blue_mask_size = 8;
+        Framebuffer->blue_mask_shift = 0;
+
+        *FramebufferPointer = HHDM(Framebuffer);
+        Response->framebuffer_count = 1;
+        Response->framebuffers = HHDM(FramebufferPointer);
+    }
+
+    TRACE("Building page tables");
+    UINT64* Pml4 = NULL;
+    CHECK_AND_RETHROW(CreatePageTables(&Pml4));
+    CHECK_AND_RETHROW(MapPages(Pml4, VirtualBase, KernelBase, EFI_PAGES_TO_SIZE(KernelPages)));
+    CHECK_AND_RETHROW(MapPhysicalMemory(Pml4, 0));
+    CHECK_AND_RETHROW(MapPhysicalMemory(Pml4, HIGHER_HALF_OFFSET));
+
+    EFI_PHYSICAL_ADDRESS Stack = 0;
+    EFI_CHECK(TrackedAllocatePages(MEM_TAG_BOOT_INFO, AllocateAnyPages, EfiLoaderData, EFI_SIZE_TO_PAGES(LIMINE_STACK_SIZE), &Stack));
+
+    // Nothing can be allocated once boot services are gone, so make room
+    // for the memory map up front, along with the entries split off by the
+    // ranges and whatever the allocations here add to it
+    UINTN MemoryMapSize = 0;
+    UINTN MapKey;
+    UINTN DescriptorSize;
+    UINT32 DescriptorVersion;
+    CHECK(gBS->GetMemoryMap(&MemoryMapSize, NULL, &MapKey, &DescriptorSize, &DescriptorVersion) == EFI_BUFFER_TOO_SMALL);
+    MemoryMapSize += 16 * DescriptorSize;
+    MemoryMap = AllocatePool(MemoryMapSize);
+    CHECK_ERROR(MemoryMap != NULL, EFI_OUT_OF_RESOURCES);
+
+    LIMINE_MEMMAP Memmap = {};
+    Memmap.Capacity = MemoryMapSize / DescriptorSize + 2 * RangeCount;
+    Memmap.Entries = AllocateBootInfo(Memmap.Capacity * sizeof(struct limine_memmap_entry));
+    UINT64* EntryPointers = AllocateBootInfo(Memmap.Capacity * sizeof(UINT64));
+    CHECK_ERROR(Memmap.Entries != NULL && EntryPointers != NULL, EFI_OUT_OF_RESOURCES);
+
+    struct limine_memmap_response* MemmapResponse = NULL;
+    if (Requests[REQUEST_MEMMAP] != NULL) {
+        MemmapResponse = AllocateResponse(Requests[REQUEST_MEMMAP], sizeof(*MemmapResponse));
+        CHECK_ERROR(MemmapResponse != NULL, EFI_OUT_OF_RESOURCES);
+    }
+
+    LogMemUsage();
+
+    TRACE("Exiting boot services");
+    EFI_CHECK(gBS->GetMemoryMap(&MemoryMapSize, MemoryMap, &MapKey, &DescriptorSize, &DescriptorVersion));
+    EFI_CHECK(gBS->ExitBootServices(gImageHandle, MapKey));
+
+    BuildMemmap(&Memmap, MemoryMap, MemoryMapSize, DescriptorSize, Ranges, RangeCount);
+    if (MemmapResponse != NULL) {
+        for (UINTN i = 0; i < Memmap.Count; ++i) {
+            EntryPointers[i] = HHDM(&Memmap.Entries[i]);
+        }
+        MemmapResponse->entry_count = Memmap.Count;
+        MemmapResponse->entries = HHDM(EntryPointers);
+    }
+
+    JumpToLimineKernel(Ehdr->e_entry, Stack + LIMINE_STACK_SIZE, Pml4);
+
+    Halt();
+
+cleanup:
+    // Only the kernel, its file and the modules, the rest is loader data
+    for (UINTN i = 0; Ranges != NULL && i < RangeCount; ++i) {
+        if (Ranges[i].Type == LIMINE_MEMMAP_KERNEL_AND_MODULES) {
+            TrackedFreePages(Ranges[i].Tag, Ranges[i].Base, EFI_SIZE_TO_PAGES(Ranges[i].Length));
+        }
+    }
+
+    if (Ranges != NULL) {
+        FreePool(Ranges);
+    }
+
+    if (MemoryMap != NULL) {
+        FreePool(MemoryMap);
+    }
+
+    return Status;
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <Uefi.h>
+
+//
+// The parts of the Limine boot protocol we implement, see
+// https://github.com/limine-bootloader/limine/blob/trunk/PROTOCOL.md
+//
+// Pointers are handed to the kernel as addresses in the higher half direct
+// map, so they are kept as plain 64-bit values here.
+//
+
+#define LIMINE_COMMON_MAGIC 0xc7b1dd30df4c8b88ull, 0x0a82e883a194f07bull
+
+#define LIMINE_BASE_REVISION_MAGIC_0 0xf9562b2d5c95a6c8ull
+#define LIMINE_BASE_REVISION_MAGIC_1 0x6a7b384944536bdcull
+
+#define LIMINE_BOOTLOADER_INFO_REQUEST { LIMINE_COMMON_MAGIC, 0xf55038d8e2a1202full, 0x279426fcf5f59740ull }
+#define LIMINE_HHDM_REQUEST { LIMINE_COMMON_MAGIC, 0x48dcf1cb8ad2b852ull, 0x63984e959a98244bull }
+#define LIMINE_FRAMEBUFFER_REQUEST { LIMINE_COMMON_MAGIC, 0x9d5827dcd881dd75ull, 0xa3148604f6fab11bull }
+#define LIMINE_MEMMAP_REQUEST { LIMINE_COMMON_MAGIC, 0x67cf3d9d378a806full, 0xe304acdfc50c3c62ull }
+#define LIMINE_KERNEL_FILE_REQUEST { LIMINE_COMMON_MAGIC, 0xad97e90e83f1ed67ull, 0x31eb5d1c5ff23b69ull }
+#define LIMINE_MODULE_REQUEST { LIMINE_COMMON_MAGIC, 0x3e7e279702be32afull, 0xca1c4f3bd1280ceeull }
+#define LIMINE_KERNEL_ADDRESS_REQUEST { LIMINE_COMMON_MAGIC, 0x71ba76863cc55f63ull, 0xb2644a48c516a487ull }
+
+// Every request starts with this
+struct limine_request {
+    UINT64 id[4];
+    UINT64 revision;
+    UINT64 response;
+};
+
+struct limine_bootloader_info_response {
+    UINT64 revision;
+    UINT64 name;
+    UINT64 version;
+};
+
+struct limine_hhdm_response {
+    UINT64 revision;
+    UINT64 offset;
+};
+
+#define LIMINE_FRAMEBUFFER_RGB 1
+
+struct limine_framebuffer {
+    UINT64 address;
+    UINT64 width;
+    UINT64 height;
+    UINT64 pitch;
+    UINT16 bpp;
+    UINT8 memory_model;
+    UINT8 red_mask_size;
+    UINT8 red_mask_shift;
+    UINT8 green_mask_size;
+    UINT8 green_mask_shift;
+    UINT8 blue_mask_size;
+    UINT8 blue_mask_shift;
+    UINT8 unused[7];
+    UINT64 edid_size;
+    UINT64 edid;
+};
+
+struct limine_framebuffer_response {
+    UINT64 revision;
+    UINT64 framebuffer_count;
+    UINT64 framebuffers;
+};
+
+#define LIMINE_MEMMAP_USABLE 0
+#define LIMINE_MEMMAP_RESERVED 1
+#define LIMINE_MEMMAP_ACPI_RECLAIMABLE 2
+#define LIMINE_MEMMAP_ACPI_NVS 3
+#define LIMINE_MEMMAP_BAD_MEMORY 4
+#define LIMINE_MEMMAP_BOOTLOADER_RECLAIMABLE 5
+#define LIMINE_MEMMAP_KERNEL_AND_MODULES 6
+#define LIMINE_MEMMAP_FRAMEBUFFER 7
+
+struct limine_memmap_entry {
+    UINT64 base;
+    UINT64 length;
+    UINT64 type;
+};
+
+struct limine_memmap_response {
+    UINT64 revision;
+    UINT64 entry_count;
+    UINT64 entries;
+};
+
+struct limine_uuid {
+    UINT32 a;
+    UINT16 b;
+    UINT16 c;
+    UINT8 d[8];
+};
+
+#define LIMINE_MEDIA_TYPE_GENERIC 0
+#define LIMINE_MEDIA_TYPE_OPTICAL 1
+#define LIMINE_MEDIA_TYPE_TFTP 2
+
+struct limine_file {
+    UINT64 revision;
+    UINT64 address;
+    UINT64 size;
+    UINT64 path;
+    UINT64 cmdline;
+    UINT32 media_type;
+    UINT32 unused;
+    UINT32 tftp_ip;
+    UINT32 tftp_port;
+    UINT32 partition_index;
+    UINT32 mbr_disk_id;
+    struct limine_uuid gpt_disk_uuid;
+    struct limine_uuid gpt_part_uuid;
+    struct limine_uuid part_uuid;
+};
+
+struct limine_kernel_file_response {
+    UINT64 revision;
+    UINT64 kernel_file;
+};
+
+struct limine_module_response {
+    UINT64 revision;
+    UINT64 module_count;
+    UINT64 modules;
+};
+
+struct limine_kernel_address_response {
+    UINT64 revision;
+    UINT64 physical_base;
+    UINT64 virtual_base;
+};
@@ -2,10 +2,208 @@
 #include <loaders/Loaders.h>
 
 #include <Library/BaseMemoryLib.h>
+#include <Library/DevicePathLib.h>
+#include <Library/FileHandleLib.h>
 #include <Library/LoadLinuxLib.h>
 #include <Library/MemoryAllocationLib.h>
+#include <Library/UefiBootServicesTableLib.h>
 
+#include <Guid/LinuxEfiInitrdMedia.h>
+#include <IndustryStandard/LinuxBzimage.h>
+#include <Protocol/DevicePath.h>
+#include <Protocol/LoadFile2.h>
+#include <Protocol/LoadedImage.h>
+
+#include <util/FileUtils.h>
 #include <util/Halt.h>
+#include <util/Log.h>
+#include <util/MemTrack.h>
+#include <util/MemUtils.h>
+#include <util/WorkPool.h>
+
+#define XLF_KERNEL_64 BIT0
+#define XLF_CAN_BE_LOADED_ABOVE_4G BIT1
+#define XLF_EFI_HANDOVER_64 BIT3
+
+// Where boot_params keeps the upper halves of the initrd address and size
+#define BOOT_PARAMS_EXT_RAMDISK_IMAGE 0x0c0
+#define BOOT_PARAMS_EXT_RAMDISK_SIZE 0x0c4
+
+// Our own setup_data type for the log of the loader, the kernel skips types
+// it doesn't know but still keeps them reserved and shows them in sysfs
+#define SETUP_RAINLOADER_LOG SIGNATURE_32('R', 'L', 'L', 'G')
+
+// And one for how much memory the loader used, as MEM_TAG_USAGE entries
+#define SETUP_RAINLOADER_MEM_USAGE SIGNATURE_32('R', 'L', 'M', 'U')
+
+#pragma pack(1)
+
+typedef struct {
+    UINT64 Next;
+    UINT32 Type;
+    UINT32 Length;
+    CHAR8 Data[0];
+} SETUP_DATA;
+
+#pragma pack()
+
+// Allocates the pages at the lowest address in [Min, Max] that has the given
+// alignment, returns zero if there is no such free range
+static EFI_PHYSICAL_ADDRESS AllocateFreeRange(UINTN Pages, UINT64 Alignment, EFI_PHYSICAL_ADDRESS Min, EFI_PHYSICAL_ADDRESS Max) {
+    EFI_PHYSICAL_ADDRESS Address = 0;
+    EFI_MEMORY_DESCRIPTOR* MemoryMap = NULL;
+    UINTN MemoryMapSize = 0;
+    UINTN MapKey;
+    UINTN DescriptorSize;
+    UINT32 DescriptorVersion;
+
+    // AllocatePages can only place whole pages
+    Alignment = MAX(Alignment, EFI_PAGE_SIZE);
+
+    if (gBS->GetMemoryMap(&MemoryMapSize, NULL, &MapKey, &DescriptorSize, &DescriptorVersion) != EFI_BUFFER_TOO_SMALL) {
+        goto cleanup;
+    }
+
+    // Allocating the map may add a few more entries to it
+    MemoryMapSize += 4 * DescriptorSize;
+    MemoryMap = AllocatePool(MemoryMapSize);
+    if (MemoryMap == NULL || EFI_ERROR(gBS->GetMemoryMap(&MemoryMapSize, MemoryMap, &MapKey, &DescriptorSize, &DescriptorVersion))) {
+        goto cleanup;
+    }
+
+    for (UINTN i = 0; i < MemoryMapSize / DescriptorSize; ++i) {
+        EFI_MEMORY_DESCRIPTOR* Desc = (EFI_MEMORY_DESCRIPTOR*)((UINTN)MemoryMap + i * DescriptorSize);
+        if (Desc->Type != EfiConventionalMemory) {
+            continue;
+        }
+
+        EFI_PHYSICAL_ADDRESS Start = ALIGN_VALUE(MAX(Desc->PhysicalStart, Min), Alignment);
+        EFI_PHYSICAL_ADDRESS End = MIN(Desc->PhysicalStart + EFI_PAGES_TO_SIZE(Desc->NumberOfPages) - 1, Max);
+        if (Start > End || End - Start + 1 < EFI_PAGES_TO_SIZE(Pages)) {
+            continue;
+        }
+
+        if (!EFI_ERROR(TrackedAllocatePages(MEM_TAG_KERNEL, AllocateAddress, EfiLoaderData, Pages, &Start))) {
+            Address = Start;
+            break;
+        }
+    }
+
+cleanup:
+    if (MemoryMap != NULL) {
+        FreePool(MemoryMap);
+    }
+
+    return Address;
+}
+
+// Places the kernel so that it can run right where it is. Anywhere other than
+// its preferred address or with a smaller alignment than it asks for, the
+// kernel first moves itself while decompressing.
+static UINT8* AllocateKernelPages(struct setup_header* Hdr, UINTN Pages) {
+    // Older kernels don't say, but they are always linked at 1MB
+    EFI_PHYSICAL_ADDRESS Preferred = BASE_1MB;
+    if (Hdr->version >= 0x20a) {
+        Preferred = Hdr->pref_address;
+    }
+
+    EFI_PHYSICAL_ADDRESS Address = Preferred;
+    if (!EFI_ERROR(TrackedAllocatePages(MEM_TAG_KERNEL, AllocateAddress, EfiLoaderData, Pages, &Address))) {
+        return (UINT8*)Address;
+    }
+
+    if (!Hdr->relocatable_kernel) {
+        return NULL;
+    }
+
+    // LoadLinux only enters the kernel in 64-bit mode through the EFI
+    // handover, otherwise it jumps to a 32-bit address
+    EFI_PHYSICAL_ADDRESS Max = MAX_UINT32;
+    UINT16 Above4G = XLF_KERNEL_64 | XLF_CAN_BE_LOADED_ABOVE_4G | XLF_EFI_HANDOVER_64;
+    if (Hdr->version >= 0x20c && Hdr->handover_offset != 0 && (Hdr->xloadflags & Above4G) == Above4G) {
+        Max = MAX_UINT64;
+    }
+
+    // Preferably above its preferred address, where the kernel runs in place
+    Address = AllocateFreeRange(Pages, Hdr->kernel_alignment, Preferred, Max);
+
+    // The kernel can also run at its minimum alignment, it is just slower
+    UINT64 MinAlignment = Hdr->kernel_alignment;
+    if (Hdr->version >= 0x20a && Hdr->min_alignment < 32) {
+        MinAlignment = LShiftU64(1, Hdr->min_alignment);
+    }
+    if (Address == 0 && MinAlignment != Hdr->kernel_alignment) {
+        Address = AllocateFreeRange(Pages, MinAlignment, Preferred, Max);
+    }
+
+    // As a last resort anywhere it can run from, it then has to move itself
+    // while decompressing but it still boots
+    if (Address == 0) {
+        Address = AllocateFreeRange(Pages, MinAlignment, BASE_1MB, Max);
+    }
+
+    return (UINT8*)Address;
+}
+
+// The highest address the kernel can still find the initrd at
+static EFI_PHYSICAL_ADDRESS GetInitrdMaxAddress(struct setup_header* Hdr) {
+    // The whole of memory, the upper half of the address goes in boot_params
+    if (Hdr->version >= 0x20c && (Hdr->xloadflags & XLF_CAN_BE_LOADED_ABOVE_4G) != 0) {
+        return MAX_ADDRESS;
+    }
+
+    // Older kernels don't say, but they can't go past this
+    if (Hdr->version < 0x203) {
+        return 0x37FFFFFF;
+    }
+
+    return Hdr->ramdisk_max;
+}
+
+// Chains a new setup_data to the list, so it outlives the handoff. The list
+// only exists since 2.09.
+static EFI_STATUS AddSetupData(struct setup_header* Hdr, UINT32 Type, UINTN Length, SETUP_DATA** Data) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    EFI_PHYSICAL_ADDRESS Address = 0;
+
+    EFI_CHECK(TrackedAllocatePages(MEM_TAG_BOOT_INFO, AllocateAnyPages, EfiLoaderData, EFI_SIZE_TO_PAGES(sizeof(SETUP_DATA) + Length), &Address));
+
+    *Data = (SETUP_DATA*)(UINTN)Address;
+    (*Data)->Next = Hdr->setup_data;
+    (*Data)->Type = Type;
+    (*Data)->Length = (UINT32)Length;
+    Hdr->setup_data = Address;
+
+cleanup:
+    return Status;
+}
+
+static EFI_STATUS AddLogSetupData(struct setup_header* Hdr) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    SETUP_DATA* Data = NULL;
+
+    UINTN LogSize = LogFormat(NULL, 0);
+    CHECK_AND_RETHROW(AddSetupData(Hdr, SETUP_RAINLOADER_LOG, LogSize, &Data));
+    LogFormat(Data->Data, LogSize);
+    Data->Length = (UINT32)AsciiStrSize(Data->Data);
+
+cleanup:
+    return Status;
+}
+
+// Taken before the setup_data of the handoff itself is allocated
+static EFI_STATUS AddMemUsageSetupData(struct setup_header* Hdr) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    MEM_TAG_USAGE Usage[MEM_TAG_COUNT];
+    SETUP_DATA* Data = NULL;
+
+    GetMemUsage(Usage);
+    CHECK_AND_RETHROW(AddSetupData(Hdr, SETUP_RAINLOADER_MEM_USAGE, sizeof(Usage), &Data));
+    CopyMem(Data->Data, Usage, sizeof(Usage));
+
+cleanup:
+    return Status;
+}
 
 /**
  * Implementation References
@@ -14,23 +212,27 @@
  */
 EFI_STATUS LoadLinuxKernel(BOOT_KERNEL_ENTRY* Entry) {
     EFI_STATUS Status = EFI_SUCCESS;
-    UINTN KernelSize = 0;
+    UINTN KernelFileSize = 0;
     UINT8* KernelImage = NULL;
 
     TRACE("Loading kernel image");
     BOOT_MODULE Module = {
         .Path = Entry->Path,
         .Fs = Entry->Fs,
+        .HasSha256 = Entry->HasSha256,
     };
-    CHECK_AND_RETHROW(LoadBootModule(&Module, (UINTN*)&KernelImage, &KernelSize));
+    CopyMem(Module.Sha256, Entry->Sha256, SHA256_DIGEST_SIZE);
+
+    // Only read from to copy the parts of the kernel out of it
+    CHECK_AND_RETHROW(LoadBootModule(&Module, LOADER_SCRATCH_MEMORY_TYPE, MAX_ADDRESS, (UINTN*)&KernelImage, &KernelFileSize));
 
     UINTN SetupSize = KernelImage[0x1f1];
     if (SetupSize == 0) {
         SetupSize = 4;
     }
     SetupSize = (SetupSize + 1) * 512;
-    CHECK(SetupSize < KernelSize);
-    KernelSize -= SetupSize;
+    CHECK(SetupSize < KernelFileSize);
+    UINTN KernelSize = KernelFileSize - SetupSize;
     TRACE("Setup Size: 0x%x", SetupSize);
 
     UINT8* SetupBuf = LoadLinuxAllocateKernelSetupPages(EFI_SIZE_TO_PAGES(SetupSize));
@@ -45,11 +247,13 @@ EFI_STATUS LoadLinuxKernel(BOOT_KERNEL_ENTRY* Entry) {
     UINT64 KernelInitialSize = LoadLinuxGetKernelSize(SetupBuf, KernelSize);
     CHECK(KernelInitialSize != 0);
     TRACE("Kernel size: 0x%x", KernelSize);
-    UINT8* KernelBuf = LoadLinuxAllocateKernelPages(SetupBuf, EFI_SIZE_TO_PAGES(KernelInitialSize));
-    CHECK(KernelBuf != NULL);
-    CopyMem(KernelBuf, KernelImage + SetupSize, KernelSize);
+    struct setup_header* Hdr = &((struct boot_params*)SetupBuf)->hdr;
+    UINT8* KernelBuf = AllocateKernelPages(Hdr, EFI_SIZE_TO_PAGES(KernelInitialSize));
+    CHECK_ERROR_TRACE(KernelBuf != NULL, EFI_OUT_OF_RESOURCES, "No room for the kernel");
+    TRACE("Kernel Buf: 0x%p", KernelBuf);
+    ParallelCopyMem(KernelBuf, KernelImage + SetupSize, KernelSize);
 
-    FreePages(KernelImage, EFI_SIZE_TO_PAGES(KernelSize));
+    TrackedFreePages(MEM_TAG_FILES, (UINTN)KernelImage, EFI_SIZE_TO_PAGES(KernelFileSize));
     KernelImage = NULL;
 
     // Load command line arguments, if any
@@ -67,33 +271,216 @@ EFI_STATUS LoadLinuxKernel(BOOT_KERNEL_ENTRY* Entry) {
     // Load the initrd, if any
     UINTN InitrdSize = 0;
     UINT8* InitrdBuf = NULL;
-    if (!IsListEmpty(&Entry->BootModules)) {
-        BOOT_MODULE* InitrdModule = BASE_CR(Entry->BootModules.ForwardLink, BOOT_MODULE, Link);
+    if (Entry->ModuleCount != 0) {
+        BOOT_MODULE* InitrdModule = &Entry->Modules[0];
 
-        UINT8* InitrdBase;
-        LoadBootModule(InitrdModule, (UINTN*)&InitrdBase, &InitrdSize);
+        // Read straight to where the kernel can reach it
+        CHECK_AND_RETHROW(LoadBootModule(InitrdModule, gKernelAndModulesMemoryType, GetInitrdMaxAddress(Hdr), (UINTN*)&InitrdBuf, &InitrdSize));
         TRACE("Initrd size: 0x%x", InitrdSize);
-
-        InitrdBuf = LoadLinuxAllocateInitrdPages(SetupBuf, EFI_SIZE_TO_PAGES(InitrdSize));
-        CHECK(InitrdBuf != NULL);
         TRACE("Initrd Buf: 0x%p", InitrdBuf);
-        CopyMem(InitrdBuf, InitrdBase, InitrdSize);
-
-        FreePages(InitrdBase, EFI_SIZE_TO_PAGES(InitrdSize));
-        InitrdBase = NULL;
     }
 
     TRACE("Loading Initrd...");
     EFI_CHECK(LoadLinuxSetInitrd(SetupBuf, InitrdBuf, InitrdSize));
 
+    // The setup header only has the lower halves
+    *(UINT32*)(SetupBuf + BOOT_PARAMS_EXT_RAMDISK_IMAGE) = (UINT32)RShiftU64((UINTN)InitrdBuf, 32);
+    *(UINT32*)(SetupBuf + BOOT_PARAMS_EXT_RAMDISK_SIZE) = (UINT32)RShiftU64(InitrdSize, 32);
+
     TRACE("Calling Linux");
+    LogMemUsage();
+    if (Hdr->version >= 0x209) {
+        CHECK_AND_RETHROW(AddMemUsageSetupData(Hdr));
+        CHECK_AND_RETHROW(AddLogSetupData(Hdr));
+    }
     EFI_CHECK(LoadLinux(KernelBuf, SetupBuf));
 
     Halt();
 
 cleanup:
     if (KernelImage != NULL) {
-        FreePages(KernelImage, KernelSize);
+        TrackedFreePages(MEM_TAG_FILES, (UINTN)KernelImage, EFI_SIZE_TO_PAGES(KernelFileSize));
+    }
+
+    return Status;
+}
+
+//
+// The EFI stub asks for the initrd through a LoadFile2 protocol on a well
+// known device path, and reads it into memory it picked itself. We read the
+// modules straight into that buffer, one after the other, which the kernel
+// treats like one big archive.
+//
+
+#pragma pack(1)
+
+typedef struct {
+    VENDOR_DEVICE_PATH Vendor;
+    EFI_DEVICE_PATH_PROTOCOL End;
+} INITRD_DEVICE_PATH;
+
+#pragma pack()
+
+static INITRD_DEVICE_PATH mInitrdDevicePath = {
+    .Vendor = {
+        .Header = { MEDIA_DEVICE_PATH, MEDIA_VENDOR_DP, { sizeof(VENDOR_DEVICE_PATH), 0 } },
+        .Guid = LINUX_EFI_INITRD_MEDIA_GUID,
+    },
+    .End = { END_DEVICE_PATH_TYPE, END_ENTIRE_DEVICE_PATH_SUBTYPE, { sizeof(EFI_DEVICE_PATH_PROTOCOL), 0 } },
+};
+
+static BOOT_KERNEL_ENTRY* mInitrdEntry = NULL;
+static UINTN mInitrdSize = 0;
+
+// Sums up the size of the modules, and reads them if there is a buffer. The
+// files are opened again for every call, so they may have grown since the
+// size was taken.
+static EFI_STATUS ReadInitrd(UINT8* Buffer, UINTN Capacity, UINTN* Size) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    EFI_FILE_PROTOCOL* root = NULL;
+    EFI_FILE_PROTOCOL* moduleImage = NULL;
+
+    *Size = 0;
+    for (UINTN i = 0; i < mInitrdEntry->ModuleCount; ++i) {
+        BOOT_MODULE* Module = &mInitrdEntry->Modules[i];
+        UINT64 ModuleSize = 0;
+
+        EFI_CHECK(Module->Fs->OpenVolume(Module->Fs, &root));
+        EFI_CHECK(root->Open(root, &moduleImage, Module->Path, EFI_FILE_MODE_READ, 0));
+        EFI_CHECK(FileHandleGetSize(moduleImage, &ModuleSize));
+
+        if (Buffer != NULL) {
+            CHECK_ERROR(ModuleSize <= Capacity - *Size, EFI_BUFFER_TOO_SMALL);
+            CHECK_AND_RETHROW(FileReadVerified(moduleImage, Buffer + *Size, ModuleSize, 0, Module->HasSha256 ? Module->Sha256 : NULL));
+        }
+        *Size += ModuleSize;
+
+        FileHandleClose(moduleImage);
+        moduleImage = NULL;
+        FileHandleClose(root);
+        root = NULL;
+    }
+
+cleanup:
+    if (moduleImage != NULL) {
+        FileHandleClose(moduleImage);
+    }
+
+    if (root != NULL) {
+        FileHandleClose(root);
+    }
+
+    return Status;
+}
+
+static EFI_STATUS EFIAPI InitrdLoadFile(EFI_LOAD_FILE2_PROTOCOL* This, EFI_DEVICE_PATH_PROTOCOL* FilePath, BOOLEAN BootPolicy, UINTN* BufferSize, VOID* Buffer) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    (VOID)This;
+
+    // LoadFile2 is never used for booting
+    CHECK_ERROR(!BootPolicy, EFI_UNSUPPORTED);
+    CHECK(BufferSize != NULL);
+
+    // The initrd is the vendor node itself, so nothing may follow it
+    CHECK_ERROR(FilePath != NULL, EFI_INVALID_PARAMETER);
+    CHECK_ERROR(IsDevicePathEnd(FilePath), EFI_NOT_FOUND);
+
+    // The stub first asks for the size so it can allocate the buffer
+    if (Buffer == NULL || *BufferSize < mInitrdSize) {
+        *BufferSize = mInitrdSize;
+        Status = EFI_BUFFER_TOO_SMALL;
+        goto cleanup;
+    }
+
+    CHECK_AND_RETHROW(ReadInitrd(Buffer, *BufferSize, BufferSize));
+
+cleanup:
+    return Status;
+}
+
+static EFI_LOAD_FILE2_PROTOCOL mInitrdLoadFile = {
+    .LoadFile = InitrdLoadFile,
+};
+
+/**
+ * Boots the kernel through the EFI stub in its bzImage, the firmware loads
+ * the PE image straight from our buffer and the stub picks where the kernel
+ * goes, so it doesn't have to move itself again while decompressing.
+ */
+EFI_STATUS LoadLinuxEfiKernel(BOOT_KERNEL_ENTRY* Entry) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    UINTN KernelSize = 0;
+    UINT8* KernelImage = NULL;
+    EFI_HANDLE KernelHandle = NULL;
+    EFI_LOADED_IMAGE_PROTOCOL* LoadedImage = NULL;
+    EFI_HANDLE InitrdHandle = NULL;
+
+    TRACE("Loading kernel image");
+    BOOT_MODULE Module = {
+        .Path = Entry->Path,
+        .Fs = Entry->Fs,
+        .HasSha256 = Entry->HasSha256,
+    };
+    CopyMem(Module.Sha256, Entry->Sha256, SHA256_DIGEST_SIZE);
+
+    // Only read from by LoadImage, which relocates the image itself
+    CHECK_AND_RETHROW(LoadBootModule(&Module, LOADER_SCRATCH_MEMORY_TYPE, MAX_ADDRESS, (UINTN*)&KernelImage, &KernelSize));
+
+    // The stub is only there when the kernel has a PE header
+    CHECK(KernelSize > 0x40);
+    BOOLEAN HasStub = KernelImage[0] == 'M' && KernelImage[1] == 'Z';
+    if (HasStub) {
+        UINT32 PeOffset = *(UINT32*)(KernelImage + 0x3c);
+        HasStub = PeOffset <= KernelSize - 4 && *(UINT32*)(KernelImage + PeOffset) == SIGNATURE_32('P', 'E', 0, 0);
+    }
+    CHECK_TRACE(HasStub, "Kernel has no EFI stub");
+
+    // The firmware copies the image into its own pages
+    EFI_CHECK(gBS->LoadImage(FALSE, gImageHandle, NULL, KernelImage, KernelSize, &KernelHandle));
+    TrackedFreePages(MEM_TAG_FILES, (UINTN)KernelImage, EFI_SIZE_TO_PAGES(KernelSize));
+    KernelImage = NULL;
+
+    // The stub reads the command line from the load options
+    EFI_CHECK(gBS->HandleProtocol(KernelHandle, &gEfiLoadedImageProtocolGuid, (VOID**)&LoadedImage));
+    LoadedImage->LoadOptions = Entry->Cmdline;
+    LoadedImage->LoadOptionsSize = (UINT32)((StrLen(Entry->Cmdline) + 1) * sizeof(CHAR16));
+    TRACE("Command line: `%s`", Entry->Cmdline);
+
+    // Only the size is needed up front, the data is read when the stub asks
+    if (Entry->ModuleCount != 0) {
+        mInitrdEntry = Entry;
+        CHECK_AND_RETHROW(ReadInitrd(NULL, 0, &mInitrdSize));
+        TRACE("Initrd size: 0x%x", mInitrdSize);
+
+        EFI_CHECK(gBS->InstallMultipleProtocolInterfaces(
+            &InitrdHandle,
+            &gEfiDevicePathProtocolGuid, &mInitrdDevicePath,
+            &gEfiLoadFile2ProtocolGuid, &mInitrdLoadFile,
+            NULL));
+    }
+
+    TRACE("Calling Linux");
+    LogMemUsage();
+    EFI_CHECK(gBS->StartImage(KernelHandle, NULL, NULL));
+
+    // The kernel is not supposed to return
+    CHECK_FAIL_TRACE("Kernel returned");
+
+cleanup:
+    if (InitrdHandle != NULL) {
+        gBS->UninstallMultipleProtocolInterfaces(
+            InitrdHandle,
+            &gEfiDevicePathProtocolGuid, &mInitrdDevicePath,
+            &gEfiLoadFile2ProtocolGuid, &mInitrdLoadFile,
+            NULL);
+    }
+
+    if (KernelHandle != NULL) {
+        gBS->UnloadImage(KernelHandle);
+    }
+
+    if (KernelImage != NULL) {
+        TrackedFreePages(MEM_TAG_FILES, (UINTN)KernelImage, EFI_SIZE_TO_PAGES(KernelSize));
     }
 
     return Status;
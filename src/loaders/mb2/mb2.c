@@ -21,7 +21,10 @@
 #include <util/FileUtils.h>
 #include <util/GfxUtils.h>
 #include <util/Halt.h>
+#include <util/Log.h>
+#include <util/MemTrack.h>
 #include <util/MemUtils.h>
+#include <util/PageTables.h>
 
 #include <ElfLib.h>
 #include <ElfLib/ElfCommon.h>
@@ -31,11 +34,51 @@
 
 #include <loaders/ElfHelpers.h>
 
+// Not part of the spec, the module tag only has room for 32-bit addresses.
+// Modules of entries with MODULES_ABOVE_4G are described with this instead,
+// and kernels that don't know it would not find them, hence the opt in.
+#define MULTIBOOT_TAG_TYPE_MODULE64 SIGNATURE_32('R', 'L', 'M', '6')
+
+struct multiboot_tag_module64 {
+    multiboot_uint32_t type;
+    multiboot_uint32_t size;
+    multiboot_uint64_t mod_start;
+    multiboot_uint64_t mod_end;
+    char cmdline[0];
+};
+
+// Also not part of the spec, the log of the loader as text. Kernels have to
+// skip tags they don't know, so this one is always passed.
+#define MULTIBOOT_TAG_TYPE_LOADER_LOG SIGNATURE_32('R', 'L', 'L', 'G')
+
+// And how much memory the loader used, by what it was used for
+#define MULTIBOOT_TAG_TYPE_LOADER_MEM_USAGE SIGNATURE_32('R', 'L', 'M', 'U')
+
+struct multiboot_tag_loader_mem_usage {
+    multiboot_uint32_t type;
+    multiboot_uint32_t size;
+    MEM_TAG_USAGE usage[MEM_TAG_COUNT];
+};
+
+// Not part of the spec, asks for a 64-bit kernel to be entered in long mode,
+// with all of the physical memory identity mapped and mapped again at
+// HIGHER_HALF_OFFSET. The entry address is the ELF entry point if zero.
+// Kernels should mark it optional so other loaders skip it.
+#define MULTIBOOT_HEADER_TAG_LONG_MODE 0x524c
+
+struct multiboot_header_tag_long_mode {
+    multiboot_uint16_t type;
+    multiboot_uint16_t flags;
+    multiboot_uint32_t size;
+    multiboot_uint64_t entry_addr;
+};
+
 static UINT8* mBootParamsBuffer = NULL;
 static UINTN mBootParamsSize = 0;
 
 extern void JumpToMB2Kernel(void* KernelStart, void* KernelParams);
 extern void JumpToAMD64MB2Kernel(void* KernelStart, void* KernelParams);
+extern void JumpToMB2LongModeKernel(void* KernelStart, void* KernelParams, UINT64* Pml4);
 
 // TODO: Make this force allocations below 4GB
 static void* PushBootParams(void* data, UINTN size) {
@@ -47,7 +90,9 @@ static void* PushBootParams(void* data, UINTN size) {
         UINT8* old = mBootParamsBuffer;
         mBootParamsBuffer = AllocateCopyPool(mBootParamsSize + AllocationSize, mBootParamsBuffer);
         FreePool(old);
+        TrackFree(MEM_TAG_BOOT_INFO, mBootParamsSize);
     }
+    TrackAllocation(MEM_TAG_BOOT_INFO, mBootParamsSize + AllocationSize);
 
     if (data != NULL) {
         CopyMem(mBootParamsBuffer + mBootParamsSize, data, size);
@@ -144,11 +189,9 @@ EFI_STATUS LoadMB2Kernel(BOOT_KERNEL_ENTRY* Entry) {
     BOOT_CONFIG config;
     LoadBootConfig(&config);
 
-    Status = gop->SetMode(gop, (UINT32)config.GfxMode);
-    ASSERT_EFI_ERROR(Status);
-
-    ActiveBackgroundColor = BLACK;
-    ActiveForegroundColor = WHITE;
+    // The kernel may ask for another resolution, so only switch once the
+    // header has been looked at
+    INT32 GfxMode = config.GfxMode;
 
     struct multiboot_header* header = LoadMB2Header(Entry->Fs, Entry->Path, &HeaderOffset);
     CHECK_ERROR_TRACE(header != NULL, EFI_NOT_FOUND, "Could not find a valid multiboot2 header!");
@@ -161,9 +204,21 @@ EFI_STATUS LoadMB2Kernel(BOOT_KERNEL_ENTRY* Entry) {
     BOOLEAN NotElf = FALSE;
     BOOLEAN IsRelocatable = FALSE;
     BOOLEAN PassBootServices = FALSE; // Ignored without EFIEntryAddressOverride.
+    BOOLEAN LongMode = FALSE;
+    UINTN LongModeEntryAddress = 0;
+    UINT64* Pml4 = NULL;
+    UINTN KernelSize = 0;
+    VOID* Elf = NULL;
+
+    // Left over from an entry that failed to boot
+    if (mBootParamsBuffer != NULL) {
+        FreePool(mBootParamsBuffer);
+        TrackFree(MEM_TAG_BOOT_INFO, mBootParamsSize);
+    }
 
     mBootParamsSize = sizeof(struct multiboot2_start_tag);
     mBootParamsBuffer = AllocatePool(sizeof(struct multiboot2_start_tag));
+    TrackAllocation(MEM_TAG_BOOT_INFO, mBootParamsSize);
 
     for (struct multiboot_header_tag* tag = (struct multiboot_header_tag*)(header + 1);
          tag < (struct multiboot_header_tag*)((UINTN)header + header->header_length) && tag->type != MULTIBOOT_HEADER_TAG_END;
@@ -225,13 +280,9 @@ EFI_STATUS LoadMB2Kernel(BOOT_KERNEL_ENTRY* Entry) {
             case MULTIBOOT_HEADER_TAG_FRAMEBUFFER: {
                 struct multiboot_header_tag_framebuffer* framebuffer = (void*)tag;
 
-                INT32 GfxMode = config.GfxMode;
                 if (!config.OverrideGfx && framebuffer->width != 0 && framebuffer->height != 0) {
                     GfxMode = GetBestGfxMode(framebuffer->width, framebuffer->height);
                 }
-
-                Status = gop->SetMode(gop, (UINT32)GfxMode);
-                ASSERT_EFI_ERROR(Status);
             } break;
 
             case MULTIBOOT_HEADER_TAG_MODULE_ALIGN: {
@@ -257,11 +308,31 @@ EFI_STATUS LoadMB2Kernel(BOOT_KERNEL_ENTRY* Entry) {
                 IsRelocatable = TRUE;
             } break;
 
+            case MULTIBOOT_HEADER_TAG_LONG_MODE: {
+                struct multiboot_header_tag_long_mode* long_mode = (void*)tag;
+                LongMode = TRUE;
+                LongModeEntryAddress = long_mode->entry_addr;
+            } break;
+
             default:
                 CHECK_FAIL_TRACE("Unsupported tag type %d", tag->type);
         }
     }
 
+    FreePool(header);
+    header = NULL;
+
+    // Switching modes clears the screen as well, but is slow, so only switch
+    // when the mode actually differs
+    if ((UINT32)GfxMode != gop->Mode->Mode) {
+        EFI_CHECK(SetGfxMode(GfxMode));
+    } else {
+        ClearScreen(BLACK);
+    }
+
+    ActiveBackgroundColor = BLACK;
+    ActiveForegroundColor = WHITE;
+
     {
         TRACE("Pushing cmdline");
         UINTN size = StrLen(Entry->Cmdline) + 1 + OFFSET_OF(struct multiboot_tag_string, string);
@@ -286,21 +357,34 @@ EFI_STATUS LoadMB2Kernel(BOOT_KERNEL_ENTRY* Entry) {
     }
 
     TRACE("Pushing modules");
-    for (LIST_ENTRY* Link = Entry->BootModules.ForwardLink; Link != &Entry->BootModules; Link = Link->ForwardLink) {
-        BOOT_MODULE* Module = BASE_CR(Link, BOOT_MODULE, Link);
+    for (UINTN i = 0; i < Entry->ModuleCount; ++i) {
+        BOOT_MODULE* Module = &Entry->Modules[i];
         UINTN Start = 0;
         UINTN Size = 0;
-        CHECK_AND_RETHROW(LoadBootModule(Module, &Start, &Size));
 
-        UINTN TotalTagSize = OFFSET_OF(struct multiboot_tag_module, cmdline) + StrLen(Module->Tag) + 1;
-        struct multiboot_tag_module* mod = PushBootParams(NULL, TotalTagSize);
-        mod->size = TotalTagSize;
-        mod->type = MULTIBOOT_TAG_TYPE_MODULE;
-        mod->mod_start = Start;
-        mod->mod_end = Start + Size;
-        UnicodeStrToAsciiStrS(Module->Tag, mod->cmdline, StrLen(Module->Tag));
+        if (Entry->ModulesAbove4G) {
+            CHECK_AND_RETHROW(LoadBootModule(Module, gKernelAndModulesMemoryType, MAX_ADDRESS, &Start, &Size));
+
+            UINTN TotalTagSize = OFFSET_OF(struct multiboot_tag_module64, cmdline) + StrLen(Module->Tag) + 1;
+            struct multiboot_tag_module64* mod = PushBootParams(NULL, TotalTagSize);
+            mod->size = TotalTagSize;
+            mod->type = MULTIBOOT_TAG_TYPE_MODULE64;
+            mod->mod_start = Start;
+            mod->mod_end = Start + Size;
+            UnicodeStrToAsciiStrS(Module->Tag, mod->cmdline, StrLen(Module->Tag) + 1);
+        } else {
+            CHECK_AND_RETHROW(LoadBootModule(Module, gKernelAndModulesMemoryType, MAX_UINT32, &Start, &Size));
+
+            UINTN TotalTagSize = OFFSET_OF(struct multiboot_tag_module, cmdline) + StrLen(Module->Tag) + 1;
+            struct multiboot_tag_module* mod = PushBootParams(NULL, TotalTagSize);
+            mod->size = TotalTagSize;
+            mod->type = MULTIBOOT_TAG_TYPE_MODULE;
+            mod->mod_start = Start;
+            mod->mod_end = Start + Size;
+            UnicodeStrToAsciiStrS(Module->Tag, mod->cmdline, StrLen(Module->Tag) + 1);
+        }
 
-        TRACE("    Added %s (%s) -> %p - %p", Module->Tag, Module->Path, mod->mod_start, mod->mod_end);
+        TRACE("    Added %s (%s) -> %p - %p", Module->Tag, Module->Path, Start, Start + Size);
     }
 
     TRACE("Pushing framebuffer info");
@@ -350,21 +434,31 @@ EFI_STATUS LoadMB2Kernel(BOOT_KERNEL_ENTRY* Entry) {
         CHECK_FAIL_TRACE("Raw images are not supported");
     }
 
-    UINTN KernelSize = 0;
     ELF_IMAGE_CONTEXT Context;
-    VOID* Elf = NULL;
     ZeroMem(&Context, sizeof(Context));
 
-    CHECK_AND_RETHROW(LoadElf(Entry->Fs, Entry->Path, (UINTN*)&Elf, &KernelSize));
+    CHECK_AND_RETHROW(LoadElf(Entry->Fs, Entry->Path, Entry->HasSha256 ? Entry->Sha256 : NULL, LOADER_SCRATCH_MEMORY_TYPE, (UINTN*)&Elf, &KernelSize));
     CHECK_AND_RETHROW(ParseElfImage(Elf, &Context));
 
     EFI_PHYSICAL_ADDRESS Base = (EFI_PHYSICAL_ADDRESS)Context.PreferredImageAddress;
-    EFI_CHECK(gBS->AllocatePages(AllocateAddress, gKernelAndModulesMemoryType, EFI_SIZE_TO_PAGES(Context.ImageSize), &Base));
+    EFI_CHECK(TrackedAllocatePages(MEM_TAG_KERNEL, AllocateAddress, gKernelAndModulesMemoryType, EFI_SIZE_TO_PAGES(Context.ImageSize), &Base));
     Context.ImageAddress = Context.PreferredImageAddress;
 
     CHECK_AND_RETHROW(LoadElfImage(&Context));
     TRACE("Loaded ELF image into memory");
 
+    // Kernels that get the boot services are entered in long mode anyway
+    if (PassBootServices && EFIEntryAddressOverride != 0) {
+        LongMode = FALSE;
+    }
+
+    if (LongMode) {
+        CHECK_TRACE(Context.EiClass == ELFCLASS64, "Long mode entry is only available for 64-bit kernels");
+        if (LongModeEntryAddress == 0) {
+            LongModeEntryAddress = Context.EntryPoint;
+        }
+    }
+
     if (PassBootServices && EFIEntryAddressOverride != 0) {
         TRACE("Pushing boot services");
         UINTN size = sizeof(struct multiboot_tag);
@@ -414,6 +508,10 @@ EFI_STATUS LoadMB2Kernel(BOOT_KERNEL_ENTRY* Entry) {
 
 #undef PushELF
 
+    // Everything the kernel needs from the file was copied out of it by now
+    TrackedFreePages(MEM_TAG_FILES, (UINTN)Elf, EFI_SIZE_TO_PAGES(KernelSize));
+    Elf = NULL;
+
     if (IsRelocatable) {
         TRACE("Pushing load base address");
         struct multiboot_tag_load_base_addr* load_base_addr = PushBootParams(NULL, sizeof(struct multiboot_tag_load_base_addr));
@@ -422,8 +520,35 @@ EFI_STATUS LoadMB2Kernel(BOOT_KERNEL_ENTRY* Entry) {
         load_base_addr->load_base_addr = (multiboot_uint32_t)(UINTN)Context.ImageAddress;
     }
 
-    TRACE("Allocating area for GDT");
-    InitLinuxDescriptorTables();
+    {
+        TRACE("Pushing the memory usage");
+        LogMemUsage();
+        struct multiboot_tag_loader_mem_usage* mem_usage = PushBootParams(NULL, sizeof(struct multiboot_tag_loader_mem_usage));
+        mem_usage->type = MULTIBOOT_TAG_TYPE_LOADER_MEM_USAGE;
+        mem_usage->size = sizeof(struct multiboot_tag_loader_mem_usage);
+        GetMemUsage(mem_usage->usage);
+    }
+
+    {
+        TRACE("Pushing the loader log");
+        UINTN LogSize = LogFormat(NULL, 0);
+        UINTN size = LogSize + OFFSET_OF(struct multiboot_tag_string, string);
+        struct multiboot_tag_string* string = PushBootParams(NULL, size);
+        string->type = MULTIBOOT_TAG_TYPE_LOADER_LOG;
+        string->size = size;
+        LogFormat(string->string, LogSize);
+    }
+
+    // Has to be done while we can still allocate
+    if (LongMode) {
+        TRACE("Building page tables");
+        CHECK_AND_RETHROW(CreatePageTables(&Pml4));
+        CHECK_AND_RETHROW(MapPhysicalMemory(Pml4, 0));
+        CHECK_AND_RETHROW(MapPhysicalMemory(Pml4, HIGHER_HALF_OFFSET));
+    } else {
+        TRACE("Allocating area for GDT");
+        InitLinuxDescriptorTables();
+    }
 
     UINT8 TmpMemoryMap[1];
     UINTN MemoryMapSize = sizeof(TmpMemoryMap);
@@ -493,6 +618,8 @@ EFI_STATUS LoadMB2Kernel(BOOT_KERNEL_ENTRY* Entry) {
 
     if (PassBootServices && EFIEntryAddressOverride != 0) {
         JumpToAMD64MB2Kernel((void*)(EFIEntryAddressOverride), mBootParamsBuffer);
+    } else if (LongMode) {
+        JumpToMB2LongModeKernel((void*)LongModeEntryAddress, mBootParamsBuffer, Pml4);
     } else {
         DisableInterrupts();
 
@@ -509,5 +636,9 @@ cleanup:
         FreePool(header);
     }
 
+    if (Elf != NULL) {
+        TrackedFreePages(MEM_TAG_FILES, (UINTN)Elf, EFI_SIZE_TO_PAGES(KernelSize));
+    }
+
     return Status;
 }
@@ -3,16 +3,24 @@
 #include <Library/BaseLib.h>
 #include <Library/CpuLib.h>
 #include <Library/DebugLib.h>
+#include <Library/MemoryAllocationLib.h>
 #include <Library/TimerLib.h>
 #include <Library/UefiBootServicesTableLib.h>
 #include <Library/UefiLib.h>
 #include <Library/UefiRuntimeServicesTableLib.h>
 #include <config/BootConfig.h>
 #include <config/BootEntries.h>
+#include <config/OneShotEntry.h>
+#include <loaders/Loaders.h>
 #include <menus/Menus.h>
 #include <util/Colors.h>
+#include <util/DrawUtils.h>
 #include <util/Except.h>
+#include <util/GfxUtils.h>
 #include <util/Halt.h>
+#include <util/MenuKey.h>
+#include <util/VolumeUtils.h>
+#include <util/WorkPool.h>
 
 // Define all constructors
 extern EFI_STATUS EFIAPI UefiBootServicesTableLibConstructor(IN EFI_HANDLE ImageHandle, IN EFI_SYSTEM_TABLE* SystemTable);
@@ -37,18 +45,53 @@ EFI_STATUS EFIAPI EfiMain(IN EFI_HANDLE ImageHandle, IN EFI_SYSTEM_TABLE* System
     // Disable the watchdog timer
     EFI_CHECK(gST->BootServices->SetWatchdogTimer(0, 0, 0, NULL));
 
+    // Before anything slow, a key that was held since power on may not be
+    // held for much longer
+    PollMenuKey();
+
     // Workaround for old AMI firmware
     if (StrCmp(gST->FirmwareVendor, L"American Megatrends") == 0 && gST->FirmwareRevision <= 0x0005000C) {
         gKernelAndModulesMemoryType = EfiMemoryMappedIOPortSpace;
     }
 
+    // Query the graphics modes once, this also locates the framebuffer
+    CHECK_AND_RETHROW(InitGfxModes());
+
     // Load boot configs and set the default one
     BOOT_CONFIG config;
-    LoadBootConfig(&config); // Also initializes the framebuffer.
+    LoadBootConfig(&config);
+
+    // An entry asked for by the OS for this boot only is booted without
+    // drawing anything at all
+    CHAR16* OneShotEntry = TakeOneShotEntry();
+    if (OneShotEntry == NULL) {
+        ClearScreen(WHITE);
+    }
 
-    ClearScreen(WHITE);
+    // Without the other processors everything simply runs on the BSP
+    InitWorkPool();
 
+    CHECK_AND_RETHROW(BuildVolumeIndex());
     CHECK_AND_RETHROW(GetBootEntries(&gBootEntries));
+
+    if (OneShotEntry != NULL) {
+        // A zero timeout only parses up to the default entry
+        BOOT_KERNEL_ENTRY* Entry = FindKernelEntry(OneShotEntry);
+        if (Entry == NULL) {
+            CHECK_AND_RETHROW(FinishBootEntries());
+            Entry = FindKernelEntry(OneShotEntry);
+        }
+        FreePool(OneShotEntry);
+
+        // Only returns if the boot failed, in which case we go on as usual
+        if (Entry != NULL) {
+            LoadKernel(Entry);
+        }
+        ClearScreen(WHITE);
+    }
+
+    // The config may have changed the default entry
+    LoadBootConfig(&config);
     gDefaultEntry = GetKernelEntryAt(config.DefaultOS);
 
     StartMenus();
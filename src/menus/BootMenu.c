@@ -7,11 +7,29 @@
 
 #include <Uefi.h>
 
+#include <Library/BaseLib.h>
 #include <Library/CpuLib.h>
 #include <Library/DebugLib.h>
+#include <Library/MemoryAllocationLib.h>
 #include <Library/UefiBootServicesTableLib.h>
 #include <loaders/Loaders.h>
 
+#define SEARCH_MAX_LENGTH 64
+
+// The first row used for entries
+#define FIRST_ROW 2
+
+// Lowercase names of the boot entries, built once for searching
+static CHAR16** mLowerNames = NULL;
+static UINTN mEntryCount = 0;
+
+// The entries matching the current search, as indices into gBootEntries
+static UINTN* mVisible = NULL;
+static UINTN mVisibleCount = 0;
+
+static CHAR16 mSearch[SEARCH_MAX_LENGTH + 1];
+static UINTN mSearchLength = 0;
+
 static void draw() {
     UINTN width = GetColumns();
     UINTN height = GetRows();
@@ -29,50 +47,155 @@ static void draw() {
 static const char* loader_names[] = {
     [BOOT_LINUX] = "Linux Boot",
     [BOOT_MB2] = "Multiboot2",
+    [BOOT_LINUX_EFI] = "Linux EFI Stub",
+    [BOOT_LIMINE] = "Limine",
 };
 
-MENU EnterBootMenu() {
-    EFI_STATUS Status = EFI_SUCCESS;
-    UINTN width = GetColumns();
+static CHAR16* get_entry_name(BOOT_ENTRY* entry) {
+    switch (entry->EntryType) {
+        case BOOT_ENTRY_KERNEL:
+            return entry->Kernel.Name;
+        case BOOT_ENTRY_ACTION:
+            return entry->Action.Name;
+    }
+    return L"";
+}
 
-    draw();
+static void build_index() {
+    UINTN count = gBootEntries.EntryCount;
+    if (mLowerNames != NULL && count == mEntryCount) {
+        return;
+    }
 
-    INTN selected = 0;
-    BOOT_ENTRY* selectedEntry = NULL;
+    if (mLowerNames != NULL) {
+        for (UINTN i = 0; i < mEntryCount; ++i) {
+            FreePool(mLowerNames[i]);
+        }
+        FreePool(mLowerNames);
+        FreePool(mVisible);
+    }
 
-    while (TRUE) {
-        // Draw the entries
-        // TODO: Add a way to edit the command line
-        INTN i = 0;
-        for (LIST_ENTRY* link = gBootEntries.ForwardLink; link != &gBootEntries; link = link->ForwardLink, ++i) {
-            BOOT_ENTRY* entry = BASE_CR(link, BOOT_ENTRY, Link);
-            UINTN offset = 2;
-            if (entry->EntryType == BOOT_ENTRY_ACTION) {
-                ++offset;
-            }
+    mEntryCount = count;
+    mLowerNames = AllocatePool(count * sizeof(CHAR16*));
+    mVisible = AllocatePool(count * sizeof(UINTN));
+    ASSERT(mLowerNames != NULL && mVisible != NULL);
 
-            // Draw the correct background
-            if (i == selected) {
-                selectedEntry = entry;
-                FillBox(4, offset + i, (int)width - 8, 1, LIGHTGREY);
-                ActiveBackgroundColor = LIGHTGREY;
-            } else {
-                FillBox(4, offset + i, (int)width - 8, 1, BackgroundColor);
+    for (UINTN i = 0; i < count; ++i) {
+        CHAR16* name = get_entry_name(&gBootEntries.Entries[i]);
+        mLowerNames[i] = AllocateCopyPool(StrSize(name), name);
+        ASSERT(mLowerNames[i] != NULL);
+        for (CHAR16* c = mLowerNames[i]; *c != CHAR_NULL; ++c) {
+            if (*c >= L'A' && *c <= L'Z') {
+                *c += L'a' - L'A';
             }
+        }
+    }
+}
 
-            // Write the option
-            switch (entry->EntryType) {
-                case BOOT_ENTRY_KERNEL:
-                    BOOT_KERNEL_ENTRY* KernelEntry = entry->Entry;
-                    WriteAt(6, offset + i, "%s (%s) - %a", KernelEntry->Name, KernelEntry->Path, loader_names[KernelEntry->Protocol]);
-                    break;
-                case BOOT_ENTRY_ACTION:
-                    BOOT_ACTION_ENTRY* ActionEntry = entry->Entry;
-                    WriteAt(6, offset + i, "%s", ActionEntry->Name);
-                    break;
+// Narrows the visible set down to the entries matching the search. Since
+// typing only ever narrows the results we can start from the current set,
+// only a deletion needs to start over from all the entries.
+static void filter_entries(BOOLEAN narrow) {
+    UINTN count = 0;
+
+    if (narrow) {
+        for (UINTN i = 0; i < mVisibleCount; ++i) {
+            if (StrStr(mLowerNames[mVisible[i]], mSearch) != NULL) {
+                mVisible[count++] = mVisible[i];
+            }
+        }
+    } else {
+        for (UINTN i = 0; i < mEntryCount; ++i) {
+            if (mSearchLength == 0 || StrStr(mLowerNames[i], mSearch) != NULL) {
+                mVisible[count++] = i;
             }
-            ActiveBackgroundColor = BackgroundColor;
         }
+    }
+
+    mVisibleCount = count;
+}
+
+static UINTN get_viewport_rows() {
+    // Leave room for the title, and the bottom bar
+    return GetRows() - FIRST_ROW - 3;
+}
+
+// Draws a single entry row, only the rows that change get redrawn
+static void draw_entry(BOOT_ENTRY* entry, UINTN row, BOOLEAN selected) {
+    UINTN width = GetColumns();
+
+    // Draw the correct background
+    if (selected) {
+        FillBox(4, FIRST_ROW + row, (int)width - 8, 1, LIGHTGREY);
+        ActiveBackgroundColor = LIGHTGREY;
+    } else {
+        FillBox(4, FIRST_ROW + row, (int)width - 8, 1, BackgroundColor);
+    }
+
+    // Write the option
+    switch (entry->EntryType) {
+        case BOOT_ENTRY_KERNEL:
+            BOOT_KERNEL_ENTRY* KernelEntry = &entry->Kernel;
+            WriteAt(6, FIRST_ROW + row, "%s (%s) - %a", KernelEntry->Name, KernelEntry->Path, loader_names[KernelEntry->Protocol]);
+            break;
+        case BOOT_ENTRY_ACTION:
+            BOOT_ACTION_ENTRY* ActionEntry = &entry->Action;
+            WriteAt(6, FIRST_ROW + row, "%s", ActionEntry->Name);
+            break;
+    }
+    ActiveBackgroundColor = BackgroundColor;
+}
+
+// Draws all the rows of the viewport, only needed when it scrolls or the
+// search changes
+static void draw_viewport(UINTN top, UINTN selected) {
+    UINTN rows = get_viewport_rows();
+
+    for (UINTN row = 0; row < rows; ++row) {
+        if (top + row < mVisibleCount) {
+            draw_entry(&gBootEntries.Entries[mVisible[top + row]], row, top + row == selected);
+        } else {
+            FillBox(4, FIRST_ROW + row, (int)GetColumns() - 8, 1, BackgroundColor);
+        }
+    }
+}
+
+static void draw_search() {
+    UINTN width = GetColumns();
+    UINTN height = GetRows();
+
+    FillBox(0, (int)(height - 2), (int)width, 1, LIGHTGREY);
+    ActiveBackgroundColor = LIGHTGREY;
+    if (mSearchLength != 0) {
+        WriteAt(2, height - 2, "Search: %s (%d found)", mSearch, mVisibleCount);
+    } else {
+        WriteAt(2, height - 2, "Type to search");
+    }
+    ActiveBackgroundColor = BackgroundColor;
+}
+
+MENU EnterBootMenu() {
+    EFI_STATUS Status = EFI_SUCCESS;
+
+    build_index();
+
+    mSearchLength = 0;
+    mSearch[0] = CHAR_NULL;
+    filter_entries(FALSE);
+
+    draw();
+
+    // Only the rows on screen are ever drawn, and after that only the rows
+    // whose selection state changes, unless the viewport has to scroll
+    // TODO: Add a way to edit the command line
+    UINTN rows = get_viewport_rows();
+    UINTN top = 0;
+    UINTN selected = 0;
+    draw_viewport(top, selected);
+    draw_search();
+
+    while (TRUE) {
+        FlushScreen();
 
         UINTN which = 0;
         EFI_INPUT_KEY key = {};
@@ -84,27 +207,35 @@ MENU EnterBootMenu() {
         }
         ASSERT_EFI_ERROR(Status);
 
-        if (key.ScanCode == SCAN_DOWN) {
-            ++selected;
-            if (selected == i) {
-                selected = 0;
-            }
+        UINTN previous = selected;
+        BOOLEAN search_changed = FALSE;
 
-        } else if (key.ScanCode == SCAN_UP) {
-            --selected;
-            if (selected < 0) {
-                selected = i - 1;
+        if (key.ScanCode == SCAN_DOWN && mVisibleCount != 0) {
+            selected = (selected + 1) % mVisibleCount;
+        } else if (key.ScanCode == SCAN_UP && mVisibleCount != 0) {
+            selected = (selected == 0 ? mVisibleCount : selected) - 1;
+        } else if (key.ScanCode == SCAN_PAGE_DOWN && mVisibleCount != 0) {
+            selected = MIN(selected + rows, mVisibleCount - 1);
+        } else if (key.ScanCode == SCAN_PAGE_UP) {
+            selected = selected > rows ? selected - rows : 0;
+        } else if (key.ScanCode == SCAN_HOME) {
+            selected = 0;
+        } else if (key.ScanCode == SCAN_END && mVisibleCount != 0) {
+            selected = mVisibleCount - 1;
+        } else if (key.UnicodeChar == CHAR_CARRIAGE_RETURN) {
+            if (mVisibleCount == 0) {
+                continue;
             }
 
-        } else if (key.UnicodeChar == CHAR_CARRIAGE_RETURN) {
+            BOOT_ENTRY* selectedEntry = &gBootEntries.Entries[mVisible[selected]];
             switch (selectedEntry->EntryType) {
                 case BOOT_ENTRY_KERNEL:
                     ClearScreen(WHITE);
-                    LoadKernel(selectedEntry->Entry);
+                    LoadKernel(&selectedEntry->Kernel);
                     Halt();
                     break;
                 case BOOT_ENTRY_ACTION:
-                    BOOT_ACTION_ENTRY* ActionEntry = selectedEntry->Entry;
+                    BOOT_ACTION_ENTRY* ActionEntry = &selectedEntry->Action;
                     switch (ActionEntry->Action) {
                         case BOOT_ACTION_SHUTDOWN:
                             return MENU_SHUTDOWN;
@@ -112,8 +243,47 @@ MENU EnterBootMenu() {
                             return MENU_REBOOT;
                     }
             }
+        } else if (key.UnicodeChar == CHAR_BACKSPACE) {
+            if (mSearchLength != 0) {
+                mSearch[--mSearchLength] = CHAR_NULL;
+                filter_entries(FALSE);
+                search_changed = TRUE;
+            }
         } else if (key.ScanCode == SCAN_ESC) {
-            return MENU_MAIN_MENU;
+            if (mSearchLength == 0) {
+                return MENU_MAIN_MENU;
+            }
+
+            // First escape only clears the search
+            mSearchLength = 0;
+            mSearch[0] = CHAR_NULL;
+            filter_entries(FALSE);
+            search_changed = TRUE;
+        } else if (key.UnicodeChar >= L' ' && key.UnicodeChar <= L'~' && mSearchLength < SEARCH_MAX_LENGTH) {
+            CHAR16 c = key.UnicodeChar;
+            if (c >= L'A' && c <= L'Z') {
+                c += L'a' - L'A';
+            }
+            mSearch[mSearchLength++] = c;
+            mSearch[mSearchLength] = CHAR_NULL;
+            filter_entries(TRUE);
+            search_changed = TRUE;
+        }
+
+        if (search_changed) {
+            selected = 0;
+            top = 0;
+            draw_viewport(top, selected);
+            draw_search();
+        } else if (selected != previous) {
+            if (selected < top || selected >= top + rows) {
+                // Scroll so the selection is in view
+                top = selected < top ? selected : selected - rows + 1;
+                draw_viewport(top, selected);
+            } else {
+                draw_entry(&gBootEntries.Entries[mVisible[previous]], previous - top, FALSE);
+                draw_entry(&gBootEntries.Entries[mVisible[selected]], selected - top, TRUE);
+            }
         }
     }
 }
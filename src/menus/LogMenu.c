@@ -0,0 +1,34 @@
+#include "Menus.h"
+
+#include <util/DrawUtils.h>
+#include <util/Log.h>
+#include <util/MemTrack.h>
+
+#include <Uefi.h>
+
+#include <Library/DebugLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+
+MENU EnterLogMenu() {
+    EFI_STATUS Status = EFI_SUCCESS;
+
+    // Shows every level, not only the ones that were drawn while logging.
+    // The memory usage goes in the log, so it ends up on the serial port too.
+    LogMemUsage();
+    LogRender();
+    WriteAt(3, GetRows() - 1, "Press any key to go back");
+    FlushScreen();
+
+    // Whoever looks at the screen may just as well have a terminal attached
+    LogWriteSerial();
+
+    do {
+        UINTN which = 0;
+        EFI_INPUT_KEY key = {};
+        Status = gBS->WaitForEvent(1, &gST->ConIn->WaitForKey, &which);
+        ASSERT_EFI_ERROR(Status);
+        Status = gST->ConIn->ReadKeyStroke(gST->ConIn, &key);
+    } while (Status == EFI_NOT_READY);
+
+    return MENU_MAIN_MENU;
+}
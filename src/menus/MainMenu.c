@@ -4,7 +4,9 @@
 #include <config/BootEntries.h>
 #include <util/Colors.h>
 #include <util/DrawUtils.h>
+#include <util/GfxUtils.h>
 #include <util/Halt.h>
+#include <util/MenuKey.h>
 
 #include <Uefi.h>
 
@@ -24,10 +26,9 @@ static void draw() {
     BOOT_CONFIG config;
     LoadBootConfig(&config);
 
-    EFI_GRAPHICS_OUTPUT_MODE_INFORMATION* info = NULL;
-    UINTN sizeOfInfo = sizeof(EFI_GRAPHICS_OUTPUT_MODE_INFORMATION);
-    Status = gop->QueryMode(gop, config.GfxMode, &sizeOfInfo, &info);
-    ASSERT_EFI_ERROR(Status);
+    UINT32 modeWidth = 0;
+    UINT32 modeHeight = 0;
+    GetGfxModeSize(config.GfxMode, &modeWidth, &modeHeight);
 
     ClearScreen(WHITE);
 
@@ -39,7 +40,7 @@ static void draw() {
     Status = gRT->GetTime(&time, NULL);
     ASSERT_EFI_ERROR(Status);
     WriteAt(3, 5, "Current time: %02d/%02d/%d %02d:%02d", time.Day, time.Month, time.Year, time.Hour, time.Minute);
-    WriteAt(3, 6, "Graphics mode: %dx%d", info->HorizontalResolution, info->VerticalResolution);
+    WriteAt(3, 6, "Graphics mode: %dx%d", modeWidth, modeHeight);
     if (gDefaultEntry != NULL) {
         WriteAt(3, 7, "Current OS: %s (%s)", gDefaultEntry->Name, gDefaultEntry->Path);
     } else {
@@ -51,6 +52,19 @@ static void draw() {
     WriteAt(3, 13, "Press B for BOOTMENU");
     WriteAt(3, 14, "Press S for SETUP");
     WriteAt(3, 15, "Press TAB for SHUTDOWN");
+    WriteAt(3, 16, "Press L for LOG");
+}
+
+// Only called once per displayed second, this is the only thing that
+// changes on the screen while waiting for the timeout
+static void draw_countdown(INTN remaining, INTN total) {
+    UINTN width = GetColumns();
+
+    WriteAt(3, 17, "Booting in %d second%a ", remaining, remaining == 1 ? "" : "s");
+
+    ActiveBackgroundColor = LIGHTGREY;
+    FillBox(0, 18, (int)(((total - remaining) * width) / total), 1, LIGHTGREY);
+    ActiveBackgroundColor = BackgroundColor;
 }
 
 MENU EnterMainMenu(BOOLEAN first) {
@@ -58,29 +72,36 @@ MENU EnterMainMenu(BOOLEAN first) {
     BOOT_CONFIG config;
     LoadBootConfig(&config);
 
-    if (config.BootDelay <= 0 && gDefaultEntry != NULL) {
+    // Holding the menu key is the only way to the menu without a timeout
+    if (first && config.BootDelay <= 0 && gDefaultEntry != NULL && !IsMenuKeyHeld()) {
+        // Only returns if the boot failed, in which case we show the menu
         LoadKernel(gDefaultEntry);
-        Halt();
     }
 
+    // Booting right away may have skipped the end of the config
+    Status = FinishBootEntries();
+    ASSERT_EFI_ERROR(Status);
+    gDefaultEntry = GetKernelEntryAt(config.DefaultOS);
+
     draw();
 
-    const UINTN TIMER_INTERVAL = 250000; // 1/40 sec
-    const UINTN INITIAL_TIMEOUT_COUNTER = (config.BootDelay * 10000000) / TIMER_INTERVAL;
-    const UINTN BAR_WIDTH = GetColumns();
+    const UINTN TIMER_INTERVAL = 10000000; // 1 sec
 
-    INTN timeout_counter = INITIAL_TIMEOUT_COUNTER;
+    INTN timeout = config.BootDelay;
     EFI_EVENT events[2] = {gST->ConIn->WaitForKey};
     Status = gBS->CreateEvent(EVT_TIMER, TPL_CALLBACK, NULL, NULL, &events[1]);
     ASSERT_EFI_ERROR(Status);
 
-    if (first && ContainsKernel()) {
-        Status = gBS->SetTimer(events[1], TimerRelative, TIMER_INTERVAL);
+    if (first && ContainsKernel() && !config.DisableTimer && config.BootDelay > 0) {
+        draw_countdown(timeout, config.BootDelay);
+        Status = gBS->SetTimer(events[1], TimerPeriodic, TIMER_INTERVAL);
         ASSERT_EFI_ERROR(Status);
     }
 
     UINTN count = 2;
     do {
+        FlushScreen();
+
         // Wait for a key press
         UINTN which = 0;
         EFI_INPUT_KEY key = {};
@@ -102,41 +123,33 @@ MENU EnterMainMenu(BOOLEAN first) {
                 ASSERT_EFI_ERROR(Status);
                 count = 1;
 
-                // Clear the progress bar
-                for (UINTN i = 0; i < BAR_WIDTH; ++i) {
-                    WriteAt(i, 18, " ");
-                }
+                // Clear the countdown and the progress bar
+                FillBox(0, 17, (int)GetColumns(), 2, BackgroundColor);
             }
 
             if (key.UnicodeChar == L'b' || key.UnicodeChar == L'B') {
                 return MENU_BOOT_MENU;
             } else if (key.UnicodeChar == L's' || key.UnicodeChar == L'S') {
                 return MENU_SETUP;
+            } else if (key.UnicodeChar == L'l' || key.UnicodeChar == L'L') {
+                return MENU_LOG;
             } else if (key.UnicodeChar == CHAR_TAB) {
                 return MENU_SHUTDOWN;
             }
 
-        } else if (!config.DisableTimer) {
-            // Timeout reached
-            timeout_counter--;
-            if (timeout_counter <= 0) {
+        } else {
+            // Another second passed
+            timeout--;
+            if (timeout <= 0) {
+                Status = gBS->SetTimer(events[1], TimerCancel, 0);
+                ASSERT_EFI_ERROR(Status);
                 Status = gBS->CloseEvent(events[1]);
                 ASSERT_EFI_ERROR(Status);
+                count = 1;
 
                 LoadKernel(config.DefaultOS > 0 ? GetKernelEntryAt(config.DefaultOS) : gDefaultEntry);
             } else {
-                // Write a new chunk of the bar
-                int start = ((INITIAL_TIMEOUT_COUNTER - timeout_counter - 1) * BAR_WIDTH) / INITIAL_TIMEOUT_COUNTER;
-                int end = ((INITIAL_TIMEOUT_COUNTER - timeout_counter) * BAR_WIDTH) / INITIAL_TIMEOUT_COUNTER;
-                ActiveBackgroundColor = LIGHTGREY;
-                for (int i = start; i <= end; ++i) {
-                    WriteAt(i, 18, " ");
-                }
-                ActiveBackgroundColor = BackgroundColor;
-
-                // Restart the timer
-                Status = gBS->SetTimer(events[1], TimerRelative, TIMER_INTERVAL);
-                ASSERT_EFI_ERROR(Status);
+                draw_countdown(timeout, config.BootDelay);
             }
         }
     } while (TRUE);
@@ -5,17 +5,22 @@
 #include <Library/BaseLib.h>
 #include <Library/UefiRuntimeServicesTableLib.h>
 
+#include <util/DrawUtils.h>
 #include <util/Halt.h>
 
 MENU EnterMainMenu(BOOLEAN first);
 MENU EnterSetupMenu();
 MENU EnterBootMenu();
+MENU EnterLogMenu();
 
 void StartMenus() {
     MENU current_menu = MENU_MAIN_MENU;
     BOOLEAN first = TRUE;
 
     while (TRUE) {
+        // Draw the menus off-screen, this is a no-op if already enabled
+        EnableBackBuffer();
+
         switch (current_menu) {
             case MENU_MAIN_MENU:
                 current_menu = EnterMainMenu(first);
@@ -29,6 +34,10 @@ void StartMenus() {
                 current_menu = EnterSetupMenu();
                 break;
 
+            case MENU_LOG:
+                current_menu = EnterLogMenu();
+                break;
+
             case MENU_SHUTDOWN:
                 gRT->ResetSystem(EfiResetShutdown, 0, 0, L"Shutdown");
                 CpuDeadLoop();
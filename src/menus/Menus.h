@@ -3,6 +3,7 @@
 typedef enum {
     MENU_BOOT_MENU,
     MENU_MAIN_MENU,
+    MENU_LOG,
     MENU_REBOOT,
     MENU_SETUP,
     MENU_SHUTDOWN,
@@ -105,11 +105,10 @@ MENU EnterSetupMenu() {
                 config.GfxMode = GetPrevGfxMode(config.GfxMode);
             }
         });
-        EFI_GRAPHICS_OUTPUT_MODE_INFORMATION* info = NULL;
-        UINTN sizeOfInfo = sizeof(EFI_GRAPHICS_OUTPUT_MODE_INFORMATION);
-        Status = gop->QueryMode(gop, config.GfxMode, &sizeOfInfo, &info);
-        ASSERT_EFI_ERROR(Status);
-        WriteAt(controls_start, control_line++, "Graphics Mode: %dx%d (BGRA8)", info->HorizontalResolution, info->VerticalResolution);
+        UINT32 modeWidth = 0;
+        UINT32 modeHeight = 0;
+        GetGfxModeSize(config.GfxMode, &modeWidth, &modeHeight);
+        WriteAt(controls_start, control_line++, "Graphics Mode: %dx%d (BGRA8)", modeWidth, modeHeight);
 
         /**
          * Override Resolution: if false then we will only fall back to this resolution,
@@ -156,6 +155,8 @@ MENU EnterSetupMenu() {
 
         op = NO_OP;
 
+        FlushScreen();
+
         UINTN which = 0;
         EFI_INPUT_KEY key = {};
         Status = gBS->WaitForEvent(1, &gST->ConIn->WaitForKey, &which);
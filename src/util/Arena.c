@@ -0,0 +1,69 @@
+#include "Arena.h"
+#include "MemTrack.h"
+
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
+
+struct ARENA_BLOCK {
+    ARENA_BLOCK* Next;
+    UINTN Pages;
+};
+
+// Big enough that even a large config only takes a couple of blocks
+#define ARENA_BLOCK_SIZE SIZE_64KB
+#define ARENA_ALIGNMENT 8
+
+#define BLOCK_HEADER_SIZE ALIGN_VALUE(sizeof(ARENA_BLOCK), ARENA_ALIGNMENT)
+
+VOID* ArenaAllocate(ARENA* Arena, UINTN Size) {
+    Size = ALIGN_VALUE(Size, ARENA_ALIGNMENT);
+
+    if (Arena->Blocks != NULL && Size <= Arena->Size - Arena->Used) {
+        VOID* Buffer = (UINT8*)Arena->Blocks + Arena->Used;
+        Arena->Used += Size;
+        return Buffer;
+    }
+
+    UINTN Pages = EFI_SIZE_TO_PAGES(MAX(BLOCK_HEADER_SIZE + Size, ARENA_BLOCK_SIZE));
+    ARENA_BLOCK* Block = AllocatePages(Pages);
+    if (Block == NULL) {
+        return NULL;
+    }
+    Block->Pages = Pages;
+    TrackAllocation(MEM_TAG_CONFIG, EFI_PAGES_TO_SIZE(Pages));
+
+    // Something that doesn't leave room for anything else gets a block of its
+    // own, and we keep going with the current one
+    if (Arena->Blocks != NULL && BLOCK_HEADER_SIZE + Size >= ARENA_BLOCK_SIZE) {
+        Block->Next = Arena->Blocks->Next;
+        Arena->Blocks->Next = Block;
+    } else {
+        Block->Next = Arena->Blocks;
+        Arena->Blocks = Block;
+        Arena->Used = BLOCK_HEADER_SIZE + Size;
+        Arena->Size = EFI_PAGES_TO_SIZE(Pages);
+    }
+
+    return (UINT8*)Block + BLOCK_HEADER_SIZE;
+}
+
+VOID* ArenaAllocateCopy(ARENA* Arena, UINTN Size, const VOID* Buffer) {
+    VOID* Copy = ArenaAllocate(Arena, Size);
+    if (Copy != NULL) {
+        CopyMem(Copy, Buffer, Size);
+    }
+    return Copy;
+}
+
+VOID FreeArena(ARENA* Arena) {
+    ARENA_BLOCK* Block = Arena->Blocks;
+    while (Block != NULL) {
+        ARENA_BLOCK* Next = Block->Next;
+        TrackFree(MEM_TAG_CONFIG, EFI_PAGES_TO_SIZE(Block->Pages));
+        FreePages(Block, Block->Pages);
+        Block = Next;
+    }
+
+    ZeroMem(Arena, sizeof(ARENA));
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <Uefi.h>
+
+typedef struct ARENA_BLOCK ARENA_BLOCK;
+
+// Hands out memory from large blocks of pages, nothing is freed on its own
+// and the whole arena is released at once. A zeroed arena is empty.
+typedef struct {
+    ARENA_BLOCK* Blocks; // The first one is the one being allocated from
+    UINTN Used;
+    UINTN Size;
+} ARENA;
+
+// The memory is not zeroed, returns NULL if out of memory
+VOID* ArenaAllocate(ARENA* Arena, UINTN Size);
+
+VOID* ArenaAllocateCopy(ARENA* Arena, UINTN Size, const VOID* Buffer);
+
+VOID FreeArena(ARENA* Arena);
@@ -10,7 +10,6 @@ BOOLEAN InsideDevicePath(EFI_DEVICE_PATH* All, EFI_DEVICE_PATH* One) {
         Path = One;
         DevicePathNodeLength(Path) == DevicePathNodeLength(All) && !IsDevicePathEndType(Path) && CompareMem(Path, All, DevicePathNodeLength(All)) == 0;
         Path = NextDevicePathNode(Path), All = NextDevicePathNode(All)) {
-        TRACE("MATCH");
     }
 
     return IsDevicePathEndType(Path);
@@ -10,8 +10,18 @@
 #include "Colors.h"
 #include "DrawUtils.h"
 #include "Font.h"
+#include "MemTrack.h"
+#include "RasterUtils.h"
 
 #define PRINT_BUFFER_SIZE 256
+#define MAX_DIRTY_RECTS 16
+
+typedef struct {
+    UINT32 Left;
+    UINT32 Top;
+    UINT32 Right;
+    UINT32 Bottom;
+} DIRTY_RECT;
 
 EFI_GRAPHICS_OUTPUT_PROTOCOL* gop = NULL;
 static CHAR8 PrintBuffer[PRINT_BUFFER_SIZE];
@@ -20,8 +30,120 @@ UINT32 ActiveForegroundColor = BLACK;
 UINT32 BackgroundColor = WHITE;
 UINT32 ForegroundColor = BLACK;
 
+// The shadow surface, when enabled all drawing goes here instead of the
+// framebuffer, and dirty regions are pushed to the screen by FlushScreen
+static UINT32* BackBuffer = NULL;
+static UINTN BackBufferPages = 0;
+static DIRTY_RECT DirtyRects[MAX_DIRTY_RECTS];
+static UINTN DirtyRectCount = 0;
+
+static inline UINT32* GetSurface() {
+    return BackBuffer != NULL ? BackBuffer : (UINT32*)gop->Mode->FrameBufferBase;
+}
+
+static inline UINT32 GetSurfacePitch() {
+    return BackBuffer != NULL ? gop->Mode->Info->HorizontalResolution : gop->Mode->Info->PixelsPerScanLine;
+}
+
 static inline void PlotPixel_32bpp(int x, int y, UINT32 pixel) {
-    *((UINT32*)(gop->Mode->FrameBufferBase + 4 * gop->Mode->Info->PixelsPerScanLine * y + 4 * x)) = pixel;
+    GetSurface()[GetSurfacePitch() * y + x] = pixel;
+}
+
+static void MarkDirty(UINT32 Left, UINT32 Top, UINT32 Right, UINT32 Bottom) {
+    if (BackBuffer == NULL) {
+        return;
+    }
+
+    // Clip to the visible area
+    Right = MIN(Right, gop->Mode->Info->HorizontalResolution);
+    Bottom = MIN(Bottom, gop->Mode->Info->VerticalResolution);
+    if (Left >= Right || Top >= Bottom) {
+        return;
+    }
+
+    // Merge with a rect we touch or overlap, so that rows of text become a single blit
+    for (UINTN i = 0; i < DirtyRectCount; ++i) {
+        DIRTY_RECT* Rect = &DirtyRects[i];
+        if (Left <= Rect->Right && Rect->Left <= Right && Top <= Rect->Bottom && Rect->Top <= Bottom) {
+            Rect->Left = MIN(Rect->Left, Left);
+            Rect->Top = MIN(Rect->Top, Top);
+            Rect->Right = MAX(Rect->Right, Right);
+            Rect->Bottom = MAX(Rect->Bottom, Bottom);
+            return;
+        }
+    }
+
+    // Out of slots, collapse everything into the first one
+    if (DirtyRectCount == MAX_DIRTY_RECTS) {
+        for (UINTN i = 1; i < DirtyRectCount; ++i) {
+            DirtyRects[0].Left = MIN(DirtyRects[0].Left, DirtyRects[i].Left);
+            DirtyRects[0].Top = MIN(DirtyRects[0].Top, DirtyRects[i].Top);
+            DirtyRects[0].Right = MAX(DirtyRects[0].Right, DirtyRects[i].Right);
+            DirtyRects[0].Bottom = MAX(DirtyRects[0].Bottom, DirtyRects[i].Bottom);
+        }
+        DirtyRectCount = 1;
+        MarkDirty(Left, Top, Right, Bottom);
+        return;
+    }
+
+    DirtyRects[DirtyRectCount++] = (DIRTY_RECT){Left, Top, Right, Bottom};
+}
+
+BOOLEAN EnableBackBuffer() {
+    if (BackBuffer != NULL) {
+        return TRUE;
+    }
+
+    UINTN Width = gop->Mode->Info->HorizontalResolution;
+    UINTN Height = gop->Mode->Info->VerticalResolution;
+    BackBufferPages = EFI_SIZE_TO_PAGES(Width * Height * sizeof(UINT32));
+    BackBuffer = AllocatePages(BackBufferPages);
+    if (BackBuffer == NULL) {
+        return FALSE;
+    }
+    TrackAllocation(MEM_TAG_SCREEN, EFI_PAGES_TO_SIZE(BackBufferPages));
+
+    // Start out with whatever is currently on the screen
+    EFI_STATUS Status = gop->Blt(gop, (EFI_GRAPHICS_OUTPUT_BLT_PIXEL*)BackBuffer, EfiBltVideoToBltBuffer, 0, 0, 0, 0, Width, Height, 0);
+    if (EFI_ERROR(Status)) {
+        TrackFree(MEM_TAG_SCREEN, EFI_PAGES_TO_SIZE(BackBufferPages));
+        FreePages(BackBuffer, BackBufferPages);
+        BackBuffer = NULL;
+        return FALSE;
+    }
+
+    DirtyRectCount = 0;
+    return TRUE;
+}
+
+void DisableBackBuffer() {
+    if (BackBuffer == NULL) {
+        return;
+    }
+
+    FlushScreen();
+    TrackFree(MEM_TAG_SCREEN, EFI_PAGES_TO_SIZE(BackBufferPages));
+    FreePages(BackBuffer, BackBufferPages);
+    BackBuffer = NULL;
+    BackBufferPages = 0;
+}
+
+void FlushScreen() {
+    if (BackBuffer == NULL) {
+        return;
+    }
+
+    for (UINTN i = 0; i < DirtyRectCount; ++i) {
+        DIRTY_RECT* Rect = &DirtyRects[i];
+        EFI_STATUS Status = gop->Blt(
+            gop, (EFI_GRAPHICS_OUTPUT_BLT_PIXEL*)BackBuffer, EfiBltBufferToVideo,
+            Rect->Left, Rect->Top, Rect->Left, Rect->Top,
+            Rect->Right - Rect->Left, Rect->Bottom - Rect->Top,
+            gop->Mode->Info->HorizontalResolution * sizeof(UINT32));
+        ASSERT_EFI_ERROR(Status);
+    }
+
+    DirtyRectCount = 0;
 }
 
 UINT32 GetColumns() {
@@ -46,6 +168,8 @@ void PutChar(unsigned x_offset, unsigned y_offset, unsigned char c) {
             PlotPixel_32bpp(loop_x + x_offset * 8, loop_y + y_offset * 16, color);
         }
     }
+
+    MarkDirty(x_offset * 8, y_offset * 16, x_offset * 8 + 8, y_offset * 16 + 16);
 }
 
 void WriteAt(unsigned x_offset, unsigned y_offset, const CHAR8* fmt, ...) {
@@ -61,18 +185,23 @@ void WriteAt(unsigned x_offset, unsigned y_offset, const CHAR8* fmt, ...) {
 }
 
 void ClearScreen(UINT32 color) {
-    SetMem32((VOID*)gop->Mode->FrameBufferBase, gop->Mode->FrameBufferSize, color);
+    // Only touch the visible area, the framebuffer may have padding past
+    // the end of each scanline and more memory after the last one
+    UINT32 Width = gop->Mode->Info->HorizontalResolution;
+    UINT32 Height = gop->Mode->Info->VerticalResolution;
+
+    FillRect32(GetSurface(), GetSurfacePitch(), 0, 0, Width, Height, color, BackBuffer == NULL);
+    MarkDirty(0, 0, Width, Height);
 }
 
 void FillBox(int _x, int _y, int width, int height, UINT32 color) {
-    _x *= 8;
-    _y *= 16;
-    width *= 8;
-    height *= 16;
-
-    for (int x = _x; x < _x + width; ++x) {
-        for (int y = _y; y < _y + height; ++y) {
-            PlotPixel_32bpp(x, y, color);
-        }
-    }
+    UINT32 Left = MIN((UINT32)_x * 8, gop->Mode->Info->HorizontalResolution);
+    UINT32 Top = MIN((UINT32)_y * 16, gop->Mode->Info->VerticalResolution);
+    UINT32 Right = MIN(Left + (UINT32)width * 8, gop->Mode->Info->HorizontalResolution);
+    UINT32 Bottom = MIN(Top + (UINT32)height * 16, gop->Mode->Info->VerticalResolution);
+
+    // Write the framebuffer directly with streaming stores, but keep the
+    // back buffer in the cache since we are about to blit from it
+    FillRect32(GetSurface(), GetSurfacePitch(), Left, Top, Right - Left, Bottom - Top, color, BackBuffer == NULL);
+    MarkDirty(Left, Top, Right, Bottom);
 }
@@ -16,3 +16,14 @@ void PutChar(unsigned x_offset, unsigned y_offset, unsigned char c);
 void WriteAt(unsigned x_offset, unsigned y_offset, const CHAR8* fmt, ...);
 void ClearScreen(UINT32);
 void FillBox(int _x, int _y, int width, int height, UINT32 color);
+
+// Redirects all drawing into a shadow surface in normal RAM, returns FALSE
+// if one could not be set up and drawing keeps going to the framebuffer
+BOOLEAN EnableBackBuffer();
+
+// Flushes and releases the shadow surface, must be called before the
+// framebuffer mode changes or the screen is handed over to a kernel
+void DisableBackBuffer();
+
+// Pushes everything drawn since the last flush to the screen
+void FlushScreen();
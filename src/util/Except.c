@@ -1,4 +0,0 @@
-#include "Except.h"
-
-UINTN Row = 1;
-UINTN Column = 3;
@@ -4,18 +4,15 @@
 
 #include <Library/UefiLib.h>
 
-#include "DrawUtils.h"
+#include "Log.h"
 
 #ifndef __FILENAME__
 #    define __FILENAME__ __FILE__
 #endif
 
-extern UINTN Row;
-extern UINTN Column;
-
-#define TRACE(fmt, ...) WriteAt(Column, Row++, "[*] " fmt, ##__VA_ARGS__);
-#define WARN(fmt, ...) WriteAt(Column, Row++, "[!] " fmt, ##__VA_ARGS__);
-#define ERROR(fmt, ...) WriteAt(Column, Row++, "[-] " fmt, ##__VA_ARGS__);
+#define TRACE(fmt, ...) LOG(LOG_LEVEL_INFO, fmt, ##__VA_ARGS__);
+#define WARN(fmt, ...) LOG(LOG_LEVEL_WARN, fmt, ##__VA_ARGS__);
+#define ERROR(fmt, ...) LOG(LOG_LEVEL_ERROR, fmt, ##__VA_ARGS__);
 
 #define CHECK_ERROR_LABEL_TRACE(expr, error, label, fmt, ...)                    \
     do {                                                                         \
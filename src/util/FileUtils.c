@@ -1,5 +1,6 @@
 #include "FileUtils.h"
 
+#include <Library/BaseMemoryLib.h>
 #include <Library/DevicePathLib.h>
 #include <Library/FileHandleLib.h>
 #include <Library/MemoryAllocationLib.h>
@@ -9,6 +10,8 @@
 #include <Protocol/LoadedImage.h>
 
 #include "Except.h"
+#include "Sha256.h"
+#include "WorkPool.h"
 
 EFI_STATUS FileRead(EFI_FILE_HANDLE Handle, void* Buffer, UINTN Size, UINTN Offset) {
     EFI_STATUS Status = EFI_SUCCESS;
@@ -21,3 +24,70 @@ EFI_STATUS FileRead(EFI_FILE_HANDLE Handle, void* Buffer, UINTN Size, UINTN Offs
 cleanup:
     return Status;
 }
+
+// Large enough to keep the firmware busy, small enough that the chunk is
+// still in the cache when it is hashed
+#define VERIFY_CHUNK_SIZE SIZE_1MB
+
+typedef struct {
+    SHA256_CONTEXT* Context;
+    UINT8* Data;
+    UINTN Size;
+} HASH_WORK;
+
+static VOID HashChunk(VOID* Context, UINTN Index) {
+    HASH_WORK* Work = Context;
+    (VOID)Index;
+
+    Sha256Update(Work->Context, Work->Data, Work->Size);
+}
+
+EFI_STATUS FileReadVerified(EFI_FILE_HANDLE Handle, void* Buffer, UINTN Size, UINTN Offset, const UINT8* Sha256) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    SHA256_CONTEXT Context;
+    UINT8 Digest[SHA256_DIGEST_SIZE];
+    HASH_WORK Work;
+    BOOLEAN Hashing = FALSE;
+
+    if (Sha256 == NULL) {
+        CHECK_AND_RETHROW(FileRead(Handle, Buffer, Size, Offset));
+        goto cleanup;
+    }
+
+    // Hash every chunk right after it is read, instead of going over the
+    // whole file again once it is loaded. Another processor hashes each chunk
+    // while we are already reading the next one.
+    Sha256Init(&Context);
+    EFI_CHECK(FileHandleSetPosition(Handle, Offset));
+    for (UINTN Done = 0; Done < Size;) {
+        UINTN ReadSize = MIN(Size - Done, VERIFY_CHUNK_SIZE);
+        UINTN Expected = ReadSize;
+        EFI_CHECK(FileHandleRead(Handle, &ReadSize, (UINT8*)Buffer + Done));
+        CHECK(ReadSize == Expected);
+
+        if (Hashing) {
+            FinishWork();
+        }
+        Work.Context = &Context;
+        Work.Data = (UINT8*)Buffer + Done;
+        Work.Size = ReadSize;
+        StartWork(HashChunk, &Work, 1);
+        Hashing = TRUE;
+
+        Done += ReadSize;
+    }
+
+    FinishWork();
+    Hashing = FALSE;
+    Sha256Final(&Context, Digest);
+
+    CHECK_ERROR_TRACE(CompareMem(Digest, Sha256, SHA256_DIGEST_SIZE) == 0, EFI_SECURITY_VIOLATION, "SHA256 of the file does not match the config");
+
+cleanup:
+    // Don't leave a chunk being hashed from a buffer the caller frees
+    if (Hashing) {
+        FinishWork();
+    }
+
+    return Status;
+}
@@ -5,3 +5,7 @@
 #include <Protocol/SimpleFileSystem.h>
 
 EFI_STATUS FileRead(EFI_FILE_HANDLE Handle, void* Buffer, UINTN Size, UINTN Offset);
+
+// Same as FileRead, but when Sha256 is not NULL the data is hashed as it is
+// read and EFI_SECURITY_VIOLATION is returned if it doesn't match
+EFI_STATUS FileReadVerified(EFI_FILE_HANDLE Handle, void* Buffer, UINTN Size, UINTN Offset, const UINT8* Sha256);
@@ -5,51 +5,61 @@
 #include <Uefi.h>
 
 #include <Library/DebugLib.h>
+#include <Library/MemoryAllocationLib.h>
 #include <Library/UefiBootServicesTableLib.h>
 #include <Protocol/GraphicsOutput.h>
 
-static INT32 GetModeCommon(INT32 start, INT32 dir) {
-    EFI_STATUS Status = gBS->LocateProtocol(&gEfiGraphicsOutputProtocolGuid, NULL, (VOID**)&gop);
-    ASSERT_EFI_ERROR(Status);
-
-    EFI_GRAPHICS_OUTPUT_MODE_INFORMATION* info = NULL;
-    UINTN sizeOfInfo = sizeof(EFI_GRAPHICS_OUTPUT_MODE_INFORMATION);
-    INTN started = start;
-    BOOLEAN looped_once = FALSE;
-    do {
-        start += dir;
-
-        // Don't overflow
-        if (dir == -1) {
-            if (start < 0) {
-                start = gop->Mode->MaxMode - 1;
-            }
-        } else {
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wsign-compare"
-            if (start >= gop->Mode->MaxMode) {
-#pragma GCC diagnostic pop
-                start = 0;
-            }
-        }
+typedef struct {
+    UINT32 Mode;
+    UINT32 Width;
+    UINT32 Height;
+} GFX_MODE;
+
+// The modes in a format we can draw to, in the order of their numbers
+static GFX_MODE* mModes = NULL;
+static UINTN mModeCount = 0;
+
+EFI_STATUS InitGfxModes() {
+    EFI_STATUS Status = EFI_SUCCESS;
 
-        // Handle a full loop
-        if (started == start) {
-            // If we get to this assert then it means there is no compatible mode
-            ASSERT(!looped_once);
-            looped_once = TRUE;
-            break;
+    EFI_CHECK(gBS->LocateProtocol(&gEfiGraphicsOutputProtocolGuid, NULL, (VOID**)&gop));
+
+    mModes = AllocatePool(gop->Mode->MaxMode * sizeof(GFX_MODE));
+    CHECK_ERROR(mModes != NULL, EFI_OUT_OF_RESOURCES);
+
+    for (UINT32 i = 0; i < gop->Mode->MaxMode; ++i) {
+        EFI_GRAPHICS_OUTPUT_MODE_INFORMATION* info = NULL;
+        UINTN sizeOfInfo = sizeof(EFI_GRAPHICS_OUTPUT_MODE_INFORMATION);
+        if (EFI_ERROR(gop->QueryMode(gop, i, &sizeOfInfo, &info))) {
+            continue;
         }
 
         // Make sure this is a supported format
-        Status = gop->QueryMode(gop, start, &sizeOfInfo, &info);
-        ASSERT_EFI_ERROR(Status);
         if (info->PixelFormat == PixelBlueGreenRedReserved8BitPerColor) {
-            break;
+            mModes[mModeCount++] = (GFX_MODE){ i, info->HorizontalResolution, info->VerticalResolution };
         }
-    } while (TRUE);
+        FreePool(info);
+    }
+
+    CHECK_ERROR_TRACE(mModeCount != 0, EFI_UNSUPPORTED, "No graphics mode with a supported format");
+
+cleanup:
+    return Status;
+}
 
-    return start;
+// Returns the index of the mode in the table, or the index it would go at
+static UINTN FindMode(INT32 Mode) {
+    UINTN Low = 0;
+    UINTN High = mModeCount;
+    while (Low < High) {
+        UINTN Middle = (Low + High) / 2;
+        if ((INT32)mModes[Middle].Mode < Mode) {
+            Low = Middle + 1;
+        } else {
+            High = Middle;
+        }
+    }
+    return Low;
 }
 
 INT32 GetFirstGfxMode() {
@@ -57,45 +67,55 @@ INT32 GetFirstGfxMode() {
 }
 
 INT32 GetNextGfxMode(INT32 Current) {
-    return GetModeCommon(Current, 1);
+    UINTN Index = FindMode(Current);
+    if (Index < mModeCount && (INT32)mModes[Index].Mode == Current) {
+        Index++;
+    }
+    return mModes[Index % mModeCount].Mode;
 }
 
 INT32 GetPrevGfxMode(INT32 Current) {
-    return GetModeCommon(Current, -1);
+    UINTN Index = FindMode(Current);
+    return mModes[(Index + mModeCount - 1) % mModeCount].Mode;
 }
 
 INT32 GetBestGfxMode(UINT32 Width, UINT32 Height) {
-    EFI_STATUS Status = gBS->LocateProtocol(&gEfiGraphicsOutputProtocolGuid, NULL, (VOID**)&gop);
-    ASSERT_EFI_ERROR(Status);
-
-    EFI_GRAPHICS_OUTPUT_MODE_INFORMATION* info = NULL;
-    UINTN sizeOfInfo = sizeof(EFI_GRAPHICS_OUTPUT_MODE_INFORMATION);
-
     INT32 goodOption = 0;
     UINT32 BestWidth = 0;
     UINT32 BestHeight = 0;
-    for (INTN i = 0; i < gop->Mode->MaxMode; ++i) {
-        // Make sure that this is a supported format
-        Status = gop->QueryMode(gop, i, &sizeOfInfo, &info);
-        ASSERT_EFI_ERROR(Status);
-        if (info->PixelFormat != PixelBlueGreenRedReserved8BitPerColor) {
-            continue;
+    for (UINTN i = 0; i < mModeCount; ++i) {
+        GFX_MODE* Mode = &mModes[i];
+        if (Mode->Height == Height && Mode->Width == Width) {
+            return Mode->Mode;
         }
 
-        if (info->VerticalResolution == Height && info->HorizontalResolution == Width) {
-            return i;
-        }
-
-        if (
-            (info->VerticalResolution > Height && info->HorizontalResolution > Width) || (info->VerticalResolution < BestHeight && info->HorizontalResolution < BestWidth)) {
+        if ((Mode->Height > Height && Mode->Width > Width) || (Mode->Height < BestHeight && Mode->Width < BestWidth)) {
             // This is bigger than what we want or smaller than the best we got so far
             continue;
         }
 
-        BestWidth = info->HorizontalResolution;
-        BestHeight = info->VerticalResolution;
-        goodOption = i;
+        BestWidth = Mode->Width;
+        BestHeight = Mode->Height;
+        goodOption = Mode->Mode;
     }
 
     return goodOption;
 }
+
+BOOLEAN GetGfxModeSize(INT32 Mode, UINT32* Width, UINT32* Height) {
+    UINTN Index = FindMode(Mode);
+    if (Index == mModeCount || (INT32)mModes[Index].Mode != Mode) {
+        return FALSE;
+    }
+
+    *Width = mModes[Index].Width;
+    *Height = mModes[Index].Height;
+    return TRUE;
+}
+
+EFI_STATUS SetGfxMode(INT32 Mode) {
+    if ((UINT32)Mode == gop->Mode->Mode) {
+        return EFI_SUCCESS;
+    }
+    return gop->SetMode(gop, (UINT32)Mode);
+}
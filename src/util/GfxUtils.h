@@ -2,8 +2,19 @@
 
 #include <Uefi.h>
 
+// Locates the GOP and queries all of its modes once, the other functions only
+// look at the table built here
+EFI_STATUS InitGfxModes();
+
 INT32 GetFirstGfxMode();
 INT32 GetNextGfxMode(INT32 Current);
 INT32 GetPrevGfxMode(INT32 Current);
 
 INT32 GetBestGfxMode(UINT32 Width, UINT32 Height);
+
+// Gets the resolution of a mode, returns FALSE if it isn't a usable mode
+BOOLEAN GetGfxModeSize(INT32 Mode, UINT32* Width, UINT32* Height);
+
+// Only switches when the mode isn't already the current one, since that can
+// take a long time on real hardware
+EFI_STATUS SetGfxMode(INT32 Mode);
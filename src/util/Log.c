@@ -0,0 +1,273 @@
+#include "Log.h"
+#include "DrawUtils.h"
+
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/PrintLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+
+#include <Protocol/SerialIo.h>
+
+// Every message takes one fixed size record, so logging never allocates and
+// once the ring is full the oldest messages are overwritten
+#define LOG_RECORD_COUNT 512
+#define LOG_MAX_ARGS 8
+#define LOG_DATA_SIZE 176
+#define LOG_LINE_SIZE 256
+
+// Where messages are drawn as they are logged
+#define LOG_COLUMN 3
+#define LOG_FIRST_ROW 1
+
+// The arguments are kept as an array of UINTN, which is exactly what a
+// BASE_LIST is, so the record can be handed to AsciiBSPrint as is. Anything
+// passed by pointer is copied into the data, the caller's buffers are long
+// gone by the time the message is formatted.
+typedef struct {
+    UINT8 Level;
+    BOOLEAN Raw; // Too many arguments, only the format is printed
+    UINT16 DataUsed;
+    const CHAR8* Format;
+    UINTN Args[LOG_MAX_ARGS];
+    UINT8 Data[LOG_DATA_SIZE];
+} LOG_RECORD;
+
+static LOG_RECORD mRecords[LOG_RECORD_COUNT];
+
+// The number of messages logged so far, the ring holds the last of them
+static UINTN mRecordCount = 0;
+
+static UINTN mScreenLevel = LOG_LEVEL_WARN;
+static UINTN mRow = LOG_FIRST_ROW;
+
+static const CHAR8* mPrefixes[] = {
+    [LOG_LEVEL_ERROR] = "[-] ",
+    [LOG_LEVEL_WARN] = "[!] ",
+    [LOG_LEVEL_INFO] = "[*] ",
+};
+
+static BOOLEAN PushArg(LOG_RECORD* Record, UINTN* ArgCount, UINTN Value) {
+    if (*ArgCount == LOG_MAX_ARGS) {
+        Record->Raw = TRUE;
+        return FALSE;
+    }
+    Record->Args[(*ArgCount)++] = Value;
+    return TRUE;
+}
+
+// Copies Size bytes into the record and returns where they went, strings
+// that don't fit are cut short
+static VOID* PushData(LOG_RECORD* Record, const VOID* Data, UINTN Size, UINTN Terminator) {
+    UINTN Offset = ALIGN_VALUE(Record->DataUsed, sizeof(UINT64));
+    if (Offset + Terminator > LOG_DATA_SIZE || (Terminator == 0 && Offset + Size > LOG_DATA_SIZE)) {
+        return NULL;
+    }
+
+    Size = MIN(Size, LOG_DATA_SIZE - Offset - Terminator);
+    CopyMem(&Record->Data[Offset], Data, Size);
+    ZeroMem(&Record->Data[Offset + Size], Terminator);
+    Record->DataUsed = (UINT16)(Offset + Size + Terminator);
+    return &Record->Data[Offset];
+}
+
+// The flags, width and precision that may come before the type
+static BOOLEAN IsFlag(CHAR8 C) {
+    return (C >= '0' && C <= '9') || C == '-' || C == '+' || C == ' ' || C == '.' || C == ',';
+}
+
+// Walks the format the same way PrintLib does, but only to find out the
+// types of the arguments
+static VOID CaptureArgs(LOG_RECORD* Record, VA_LIST Marker) {
+    UINTN ArgCount = 0;
+
+    for (const CHAR8* Format = Record->Format; *Format != '\0'; ++Format) {
+        if (*Format != '%') {
+            continue;
+        }
+
+        BOOLEAN Long = FALSE;
+        for (++Format;; ++Format) {
+            if (*Format == 'l' || *Format == 'L') {
+                Long = TRUE;
+            } else if (*Format == '*') {
+                if (!PushArg(Record, &ArgCount, (UINTN)VA_ARG(Marker, INT32))) {
+                    return;
+                }
+            } else if (!IsFlag(*Format)) {
+                break;
+            }
+        }
+
+        VOID* Copy = NULL;
+        UINTN Value = 0;
+        switch (*Format) {
+            case '\0':
+                return;
+
+            case 'a': {
+                CHAR8* String = VA_ARG(Marker, CHAR8*);
+                if (String != NULL) {
+                    Copy = PushData(Record, String, AsciiStrLen(String), sizeof(CHAR8));
+                    String = Copy != NULL ? Copy : "";
+                }
+                Value = (UINTN)String;
+            } break;
+
+            case 's':
+            case 'S': {
+                CHAR16* String = VA_ARG(Marker, CHAR16*);
+                if (String != NULL) {
+                    Copy = PushData(Record, String, StrLen(String) * sizeof(CHAR16), sizeof(CHAR16));
+                    String = Copy != NULL ? Copy : L"";
+                }
+                Value = (UINTN)String;
+            } break;
+
+            case 'g':
+            case 't': {
+                VOID* Pointer = VA_ARG(Marker, VOID*);
+                if (Pointer != NULL) {
+                    Pointer = PushData(Record, Pointer, *Format == 'g' ? sizeof(EFI_GUID) : sizeof(EFI_TIME), 0);
+
+                    // Can't be cut short, so print the format rather than garbage
+                    if (Pointer == NULL) {
+                        Record->Raw = TRUE;
+                        return;
+                    }
+                }
+                Value = (UINTN)Pointer;
+            } break;
+
+            case 'p':
+                Value = (UINTN)VA_ARG(Marker, VOID*);
+                break;
+
+            case 'r':
+                Value = (UINTN)VA_ARG(Marker, RETURN_STATUS);
+                break;
+
+            case 'c':
+                Value = VA_ARG(Marker, UINTN);
+                break;
+
+            case 'd':
+            case 'i':
+            case 'u':
+            case 'x':
+            case 'X':
+                if (Long) {
+                    Value = (UINTN)VA_ARG(Marker, INT64);
+                } else {
+                    Value = (UINTN)VA_ARG(Marker, INT32);
+                }
+                break;
+
+            default:
+                // Takes no argument, like %%
+                continue;
+        }
+
+        if (!PushArg(Record, &ArgCount, Value)) {
+            return;
+        }
+    }
+}
+
+static UINTN FormatRecord(LOG_RECORD* Record, CHAR8* Buffer, UINTN Size) {
+    UINTN Length = AsciiSPrint(Buffer, Size, "%a", mPrefixes[Record->Level]);
+    if (Record->Raw) {
+        return Length + AsciiSPrint(Buffer + Length, Size - Length, "%a", Record->Format);
+    }
+    return Length + AsciiBSPrint(Buffer + Length, Size - Length, Record->Format, (BASE_LIST)Record->Args);
+}
+
+// Starts over at the top once the screen is full, rather than drawing off
+// the bottom of it
+static VOID DrawRecord(LOG_RECORD* Record) {
+    CHAR8 Line[LOG_LINE_SIZE];
+
+    if (mRow >= GetRows()) {
+        ClearScreen(BackgroundColor);
+        mRow = LOG_FIRST_ROW;
+    }
+
+    FormatRecord(Record, Line, sizeof(Line));
+    WriteAt(LOG_COLUMN, mRow++, "%a", Line);
+}
+
+VOID LogWrite(UINTN Level, const CHAR8* Format, ...) {
+    LOG_RECORD* Record = &mRecords[mRecordCount++ % LOG_RECORD_COUNT];
+    Record->Level = (UINT8)Level;
+    Record->Raw = FALSE;
+    Record->DataUsed = 0;
+    Record->Format = Format;
+
+    VA_LIST Marker;
+    VA_START(Marker, Format);
+    CaptureArgs(Record, Marker);
+    VA_END(Marker);
+
+    // Nothing can be drawn before the framebuffer is set up
+    if (Level <= mScreenLevel && gop != NULL) {
+        DrawRecord(Record);
+    }
+}
+
+VOID SetLogLevel(UINTN Level) {
+    mScreenLevel = MIN(Level, LOG_LEVEL_INFO);
+}
+
+VOID LogRender(VOID) {
+    // The bottom row is left for the menu to put its hint in
+    UINTN Rows = GetRows() - LOG_FIRST_ROW - 1;
+    UINTN Count = MIN(mRecordCount, LOG_RECORD_COUNT);
+
+    ClearScreen(BackgroundColor);
+    mRow = LOG_FIRST_ROW;
+    for (UINTN i = mRecordCount - MIN(Count, Rows); i < mRecordCount; ++i) {
+        DrawRecord(&mRecords[i % LOG_RECORD_COUNT]);
+    }
+}
+
+VOID LogWriteSerial(VOID) {
+    EFI_SERIAL_IO_PROTOCOL* Serial = NULL;
+    CHAR8 Line[LOG_LINE_SIZE];
+
+    if (EFI_ERROR(gBS->LocateProtocol(&gEfiSerialIoProtocolGuid, NULL, (VOID**)&Serial))) {
+        return;
+    }
+
+    UINTN Count = MIN(mRecordCount, LOG_RECORD_COUNT);
+    for (UINTN i = mRecordCount - Count; i < mRecordCount; ++i) {
+        // Leave room for the line ending
+        UINTN Length = FormatRecord(&mRecords[i % LOG_RECORD_COUNT], Line, sizeof(Line) - 2);
+        Line[Length++] = '\r';
+        Line[Length++] = '\n';
+        Serial->Write(Serial, &Length, Line);
+    }
+}
+
+UINTN LogFormat(CHAR8* Buffer, UINTN Size) {
+    CHAR8 Line[LOG_LINE_SIZE];
+    UINTN Length = 0;
+    UINTN Written = 0;
+
+    UINTN Count = MIN(mRecordCount, LOG_RECORD_COUNT);
+    for (UINTN i = mRecordCount - Count; i < mRecordCount; ++i) {
+        UINTN LineLength = FormatRecord(&mRecords[i % LOG_RECORD_COUNT], Line, sizeof(Line) - 1);
+        Line[LineLength++] = '\n';
+
+        // Stops at the first line that doesn't fit along with the terminator
+        if (Buffer != NULL && Written == Length && Written + LineLength < Size) {
+            CopyMem(Buffer + Written, Line, LineLength);
+            Written += LineLength;
+        }
+        Length += LineLength;
+    }
+
+    if (Buffer != NULL && Size != 0) {
+        Buffer[Written] = '\0';
+    }
+
+    return Length + 1;
+}
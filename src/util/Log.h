@@ -0,0 +1,39 @@
+#pragma once
+
+#include <Uefi.h>
+
+#define LOG_LEVEL_ERROR 0
+#define LOG_LEVEL_WARN 1
+#define LOG_LEVEL_INFO 2
+
+// Messages more verbose than this are compiled out entirely
+#ifndef LOG_LEVEL_MAX
+#    define LOG_LEVEL_MAX LOG_LEVEL_INFO
+#endif
+
+#define LOG(level, fmt, ...)                         \
+    do {                                             \
+        if ((level) <= LOG_LEVEL_MAX) {              \
+            LogWrite(level, fmt, ##__VA_ARGS__);     \
+        }                                            \
+    } while (0)
+
+// Keeps the message in the log ring, only the arguments are captured and the
+// message is formatted once something asks for it. Messages at or below the
+// screen level are also drawn right away.
+VOID LogWrite(UINTN Level, const CHAR8* Format, ...);
+
+// The most verbose level that is drawn as it is logged, warnings by default
+VOID SetLogLevel(UINTN Level);
+
+// Draws the most recent messages of every level that fit on the screen,
+// keeping the bottom row free
+VOID LogRender(VOID);
+
+// Writes the whole log to the first serial port, if there is one
+VOID LogWriteSerial(VOID);
+
+// Formats the whole log as lines of text, oldest first, and returns the size
+// needed for all of it including the terminator. Only whole lines that fit
+// are written, so it can be called with a NULL buffer to get the size.
+UINTN LogFormat(CHAR8* Buffer, UINTN Size);
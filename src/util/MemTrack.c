@@ -0,0 +1,62 @@
+#include "MemTrack.h"
+#include "Log.h"
+
+#include <Library/UefiBootServicesTableLib.h>
+
+static UINT64 mLive[MEM_TAG_COUNT];
+static UINT64 mPeak[MEM_TAG_COUNT];
+
+static const CHAR8* mTagNames[MEM_TAG_COUNT] = {
+    [MEM_TAG_CONFIG] = "Config",
+    [MEM_TAG_SCREEN] = "Screen",
+    [MEM_TAG_NETWORK] = "Network",
+    [MEM_TAG_WORKERS] = "Workers",
+    [MEM_TAG_FILES] = "Files",
+    [MEM_TAG_KERNEL] = "Kernel",
+    [MEM_TAG_BOOT_INFO] = "Boot info",
+    [MEM_TAG_PAGE_TABLES] = "Page tables",
+};
+
+VOID TrackAllocation(MEM_TAG Tag, UINT64 Size) {
+    mLive[Tag] += Size;
+    if (mLive[Tag] > mPeak[Tag]) {
+        mPeak[Tag] = mLive[Tag];
+    }
+}
+
+VOID TrackFree(MEM_TAG Tag, UINT64 Size) {
+    // A mismatched free is a bug, but not one worth wrapping around for
+    mLive[Tag] -= Size <= mLive[Tag] ? Size : mLive[Tag];
+}
+
+EFI_STATUS TrackedAllocatePages(MEM_TAG Tag, EFI_ALLOCATE_TYPE Type, EFI_MEMORY_TYPE MemoryType, UINTN Pages, EFI_PHYSICAL_ADDRESS* Memory) {
+    EFI_STATUS Status = gBS->AllocatePages(Type, MemoryType, Pages, Memory);
+    if (!EFI_ERROR(Status)) {
+        TrackAllocation(Tag, EFI_PAGES_TO_SIZE(Pages));
+    }
+    return Status;
+}
+
+VOID TrackedFreePages(MEM_TAG Tag, EFI_PHYSICAL_ADDRESS Memory, UINTN Pages) {
+    if (!EFI_ERROR(gBS->FreePages(Memory, Pages))) {
+        TrackFree(Tag, EFI_PAGES_TO_SIZE(Pages));
+    }
+}
+
+VOID GetMemUsage(MEM_TAG_USAGE* Usage) {
+    for (UINTN i = 0; i < MEM_TAG_COUNT; ++i) {
+        Usage[i].Tag = (UINT32)i;
+        Usage[i].Reserved = 0;
+        Usage[i].Live = mLive[i];
+        Usage[i].Peak = mPeak[i];
+    }
+}
+
+VOID LogMemUsage(VOID) {
+    LOG(LOG_LEVEL_INFO, "Memory in use (peak):");
+    for (UINTN i = 0; i < MEM_TAG_COUNT; ++i) {
+        if (mPeak[i] != 0) {
+            LOG(LOG_LEVEL_INFO, "    %-12a %8ldKB (%ldKB)", mTagNames[i], mLive[i] / SIZE_1KB, mPeak[i] / SIZE_1KB);
+        }
+    }
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <Uefi.h>
+
+// What the memory the loader allocates is used for
+typedef enum {
+    MEM_TAG_CONFIG,      // The boot entry table
+    MEM_TAG_SCREEN,      // The back buffer
+    MEM_TAG_NETWORK,     // Files cached by the TFTP filesystem
+    MEM_TAG_WORKERS,     // The state of the application processors
+    MEM_TAG_FILES,       // Kernels and modules as they were read
+    MEM_TAG_KERNEL,      // Kernel images placed where they run
+    MEM_TAG_BOOT_INFO,   // Whatever else is handed to the kernel
+    MEM_TAG_PAGE_TABLES, // Built for kernels entered with paging on
+    MEM_TAG_COUNT,
+} MEM_TAG;
+
+#pragma pack(1)
+
+// Also how the usage is handed to the kernel
+typedef struct {
+    UINT32 Tag;
+    UINT32 Reserved;
+    UINT64 Live; // In bytes
+    UINT64 Peak;
+} MEM_TAG_USAGE;
+
+#pragma pack()
+
+// Same as gBS->AllocatePages, and counts the pages towards the tag
+EFI_STATUS TrackedAllocatePages(MEM_TAG Tag, EFI_ALLOCATE_TYPE Type, EFI_MEMORY_TYPE MemoryType, UINTN Pages, EFI_PHYSICAL_ADDRESS* Memory);
+
+VOID TrackedFreePages(MEM_TAG Tag, EFI_PHYSICAL_ADDRESS Memory, UINTN Pages);
+
+// For memory that was allocated some other way
+VOID TrackAllocation(MEM_TAG Tag, UINT64 Size);
+VOID TrackFree(MEM_TAG Tag, UINT64 Size);
+
+// Fills in the usage of every tag, Usage has room for MEM_TAG_COUNT entries
+VOID GetMemUsage(MEM_TAG_USAGE* Usage);
+
+// Logs the usage of every tag that was ever used
+VOID LogMemUsage(VOID);
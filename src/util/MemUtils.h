@@ -2,4 +2,10 @@
 
 #include <Uefi.h>
 
+// Kernels, modules and whatever else is handed to the kernel
 extern EFI_MEMORY_TYPE gKernelAndModulesMemoryType;
+
+// Buffers only the loader needs, such as files that are copied elsewhere
+// before the handoff. The kernel gets back whatever is left of them along
+// with the rest of the boot services memory.
+#define LOADER_SCRATCH_MEMORY_TYPE EfiBootServicesData
@@ -0,0 +1,78 @@
+#include "MenuKey.h"
+#include "Log.h"
+
+#include <Library/BaseMemoryLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+
+#include <Protocol/SimpleTextInEx.h>
+
+// Long enough for a held key to repeat at least once on most keyboards,
+// short enough not to matter when nothing is held
+#define MENU_KEY_POLL_US 20000
+#define MENU_KEY_POLL_STEP_US 1000
+
+#define SHIFT_PRESSED (EFI_LEFT_SHIFT_PRESSED | EFI_RIGHT_SHIFT_PRESSED)
+#define CTRL_PRESSED (EFI_LEFT_CONTROL_PRESSED | EFI_RIGHT_CONTROL_PRESSED)
+#define ALT_PRESSED (EFI_LEFT_ALT_PRESSED | EFI_RIGHT_ALT_PRESSED)
+
+static MENU_KEY mMenuKey = MENU_KEY_ANY;
+
+// Everything seen while polling
+static BOOLEAN mKeyPressed = FALSE;
+static UINT32 mShiftState = 0;
+
+VOID PollMenuKey(VOID) {
+    EFI_SIMPLE_TEXT_INPUT_EX_PROTOCOL* InputEx = NULL;
+
+    // Without the extended protocol there is no shift state, but a held key
+    // still shows up as keystrokes
+    gBS->HandleProtocol(gST->ConsoleInHandle, &gEfiSimpleTextInputExProtocolGuid, (VOID**)&InputEx);
+
+    for (UINTN Waited = 0; Waited < MENU_KEY_POLL_US; Waited += MENU_KEY_POLL_STEP_US) {
+        EFI_STATUS Status;
+        EFI_KEY_DATA Key;
+        ZeroMem(&Key, sizeof(Key));
+
+        if (InputEx != NULL) {
+            Status = InputEx->ReadKeyStrokeEx(InputEx, &Key);
+        } else {
+            Status = gST->ConIn->ReadKeyStroke(gST->ConIn, &Key.Key);
+        }
+
+        if (!EFI_ERROR(Status)) {
+            // Firmware that reports modifiers on their own does it with an
+            // empty keystroke
+            if (Key.Key.ScanCode != 0 || Key.Key.UnicodeChar != 0) {
+                mKeyPressed = TRUE;
+            }
+            if ((Key.KeyState.KeyShiftState & EFI_SHIFT_STATE_VALID) != 0) {
+                mShiftState |= Key.KeyState.KeyShiftState;
+            }
+        }
+
+        gBS->Stall(MENU_KEY_POLL_STEP_US);
+    }
+
+    if (mKeyPressed || (mShiftState & (SHIFT_PRESSED | CTRL_PRESSED | ALT_PRESSED)) != 0) {
+        LOG(LOG_LEVEL_INFO, "Keys held at start (shift state %x)", mShiftState);
+    }
+}
+
+VOID SetMenuKey(MENU_KEY Key) {
+    mMenuKey = Key;
+}
+
+BOOLEAN IsMenuKeyHeld(VOID) {
+    switch (mMenuKey) {
+        case MENU_KEY_ANY:
+            return mKeyPressed || (mShiftState & (SHIFT_PRESSED | CTRL_PRESSED | ALT_PRESSED)) != 0;
+        case MENU_KEY_SHIFT:
+            return (mShiftState & SHIFT_PRESSED) != 0;
+        case MENU_KEY_CTRL:
+            return (mShiftState & CTRL_PRESSED) != 0;
+        case MENU_KEY_ALT:
+            return (mShiftState & ALT_PRESSED) != 0;
+        default:
+            return FALSE;
+    }
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <Uefi.h>
+
+// What has to be held while the loader starts to get to the menu when the
+// default entry would otherwise be booted right away
+typedef enum {
+    MENU_KEY_ANY, // Any key at all, including the modifiers
+    MENU_KEY_SHIFT,
+    MENU_KEY_CTRL,
+    MENU_KEY_ALT,
+    MENU_KEY_NONE, // The menu can't be reached that way
+} MENU_KEY;
+
+// Checks for held keys for a few milliseconds, this is done once as early as
+// possible so that the keys don't have to be held for long
+VOID PollMenuKey(VOID);
+
+// Any key by default
+VOID SetMenuKey(MENU_KEY Key);
+
+BOOLEAN IsMenuKeyHeld(VOID);
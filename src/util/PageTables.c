@@ -0,0 +1,188 @@
+#include "PageTables.h"
+#include "DrawUtils.h"
+#include "Except.h"
+#include "MemTrack.h"
+
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+
+#define PAGE_PRESENT BIT0
+#define PAGE_WRITABLE BIT1
+#define PAGE_LARGE BIT7
+#define PAGE_ADDRESS_MASK 0x000FFFFFFFFFF000ull
+
+// The levels below the PML4, a 1GB page is an entry of the PDPT
+#define LEVEL_PT 0
+#define LEVEL_PD 1
+#define LEVEL_PDPT 2
+#define LEVEL_PML4 3
+
+#define LEVEL_SHIFT(Level) (12 + 9 * (Level))
+#define LEVEL_INDEX(Address, Level) (((Address) >> LEVEL_SHIFT(Level)) & 0x1FF)
+
+typedef struct {
+    UINT64 Base;
+    UINT64 End;
+} PHYSICAL_RANGE;
+
+static BOOLEAN mHas1GbPages = FALSE;
+
+static UINT64* AllocateTable(VOID) {
+    EFI_PHYSICAL_ADDRESS Address = 0;
+    if (EFI_ERROR(TrackedAllocatePages(MEM_TAG_PAGE_TABLES, AllocateAnyPages, EfiLoaderData, 1, &Address))) {
+        return NULL;
+    }
+
+    ZeroMem((VOID*)(UINTN)Address, EFI_PAGE_SIZE);
+    return (UINT64*)(UINTN)Address;
+}
+
+EFI_STATUS CreatePageTables(UINT64** Pml4) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    UINT32 MaxExtended = 0;
+    UINT32 Edx = 0;
+
+    AsmCpuid(0x80000000, &MaxExtended, NULL, NULL, NULL);
+    if (MaxExtended >= 0x80000001) {
+        AsmCpuid(0x80000001, NULL, NULL, NULL, &Edx);
+    }
+    mHas1GbPages = (Edx & BIT26) != 0;
+
+    *Pml4 = AllocateTable();
+    CHECK_ERROR(*Pml4 != NULL, EFI_OUT_OF_RESOURCES);
+
+cleanup:
+    return Status;
+}
+
+EFI_STATUS MapPages(UINT64* Pml4, UINT64 Virtual, UINT64 Physical, UINT64 Size) {
+    EFI_STATUS Status = EFI_SUCCESS;
+
+    CHECK(((Virtual | Physical | Size) & EFI_PAGE_MASK) == 0);
+
+    while (Size != 0) {
+        UINTN Level = LEVEL_PT;
+        if (mHas1GbPages && ((Virtual | Physical) & (SIZE_1GB - 1)) == 0 && Size >= SIZE_1GB) {
+            Level = LEVEL_PDPT;
+        } else if (((Virtual | Physical) & (SIZE_2MB - 1)) == 0 && Size >= SIZE_2MB) {
+            Level = LEVEL_PD;
+        }
+
+        // Walk down to the table that holds the page, filling in the tables
+        // that are missing on the way
+        UINT64* Table = Pml4;
+        for (UINTN Current = LEVEL_PML4; Current > Level; --Current) {
+            UINT64* Entry = &Table[LEVEL_INDEX(Virtual, Current)];
+            if ((*Entry & PAGE_PRESENT) == 0) {
+                UINT64* NewTable = AllocateTable();
+                CHECK_ERROR(NewTable != NULL, EFI_OUT_OF_RESOURCES);
+                *Entry = (UINTN)NewTable | PAGE_PRESENT | PAGE_WRITABLE;
+            }
+            CHECK_TRACE((*Entry & PAGE_LARGE) == 0, "%lx is already mapped", Virtual);
+            Table = (UINT64*)(UINTN)(*Entry & PAGE_ADDRESS_MASK);
+        }
+
+        UINT64* Entry = &Table[LEVEL_INDEX(Virtual, Level)];
+        CHECK_TRACE((*Entry & PAGE_PRESENT) == 0, "%lx is already mapped", Virtual);
+        *Entry = Physical | PAGE_PRESENT | PAGE_WRITABLE | (Level != LEVEL_PT ? PAGE_LARGE : 0);
+
+        UINT64 PageSize = LShiftU64(1, LEVEL_SHIFT(Level));
+        Virtual += PageSize;
+        Physical += PageSize;
+        Size -= PageSize;
+    }
+
+cleanup:
+    return Status;
+}
+
+// Gathers the ranges to map and merges the ones that touch, so that the
+// pages can be as big as possible and nothing is mapped twice
+static EFI_STATUS GetPhysicalRanges(PHYSICAL_RANGE** Ranges, UINTN* Count) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    EFI_MEMORY_DESCRIPTOR* MemoryMap = NULL;
+    UINTN MemoryMapSize = 0;
+    UINTN MapKey;
+    UINTN DescriptorSize;
+    UINT32 DescriptorVersion;
+
+    *Ranges = NULL;
+    *Count = 0;
+
+    Status = gBS->GetMemoryMap(&MemoryMapSize, NULL, &MapKey, &DescriptorSize, &DescriptorVersion);
+    CHECK_ERROR(Status == EFI_BUFFER_TOO_SMALL, Status);
+    Status = EFI_SUCCESS;
+
+    // Allocating may add a few more descriptors
+    MemoryMapSize += 4 * DescriptorSize;
+    MemoryMap = AllocatePool(MemoryMapSize);
+    CHECK_ERROR(MemoryMap != NULL, EFI_OUT_OF_RESOURCES);
+    EFI_CHECK(gBS->GetMemoryMap(&MemoryMapSize, MemoryMap, &MapKey, &DescriptorSize, &DescriptorVersion));
+
+    UINTN DescriptorCount = MemoryMapSize / DescriptorSize;
+    *Ranges = AllocatePool((DescriptorCount + 2) * sizeof(PHYSICAL_RANGE));
+    CHECK_ERROR(*Ranges != NULL, EFI_OUT_OF_RESOURCES);
+
+    (*Ranges)[(*Count)++] = (PHYSICAL_RANGE){ 0, BASE_4GB };
+    if (gop != NULL) {
+        UINT64 Base = gop->Mode->FrameBufferBase & ~(UINT64)EFI_PAGE_MASK;
+        UINT64 End = ALIGN_VALUE(gop->Mode->FrameBufferBase + gop->Mode->FrameBufferSize, EFI_PAGE_SIZE);
+        (*Ranges)[(*Count)++] = (PHYSICAL_RANGE){ Base, End };
+    }
+    for (UINTN i = 0; i < DescriptorCount; ++i) {
+        EFI_MEMORY_DESCRIPTOR* Desc = (EFI_MEMORY_DESCRIPTOR*)((UINT8*)MemoryMap + i * DescriptorSize);
+        (*Ranges)[(*Count)++] = (PHYSICAL_RANGE){ Desc->PhysicalStart, Desc->PhysicalStart + EFI_PAGES_TO_SIZE(Desc->NumberOfPages) };
+    }
+
+    // The memory map is usually sorted already
+    for (UINTN i = 1; i < *Count; ++i) {
+        PHYSICAL_RANGE Range = (*Ranges)[i];
+        UINTN j = i;
+        for (; j > 0 && (*Ranges)[j - 1].Base > Range.Base; --j) {
+            (*Ranges)[j] = (*Ranges)[j - 1];
+        }
+        (*Ranges)[j] = Range;
+    }
+
+    UINTN Merged = 0;
+    for (UINTN i = 1; i < *Count; ++i) {
+        if ((*Ranges)[i].Base <= (*Ranges)[Merged].End) {
+            (*Ranges)[Merged].End = MAX((*Ranges)[Merged].End, (*Ranges)[i].End);
+        } else {
+            (*Ranges)[++Merged] = (*Ranges)[i];
+        }
+    }
+    *Count = Merged + 1;
+
+cleanup:
+    if (MemoryMap != NULL) {
+        FreePool(MemoryMap);
+    }
+
+    if (EFI_ERROR(Status) && *Ranges != NULL) {
+        FreePool(*Ranges);
+        *Ranges = NULL;
+    }
+
+    return Status;
+}
+
+EFI_STATUS MapPhysicalMemory(UINT64* Pml4, UINT64 Offset) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    PHYSICAL_RANGE* Ranges = NULL;
+    UINTN Count = 0;
+
+    CHECK_AND_RETHROW(GetPhysicalRanges(&Ranges, &Count));
+    for (UINTN i = 0; i < Count; ++i) {
+        CHECK_AND_RETHROW(MapPages(Pml4, Ranges[i].Base + Offset, Ranges[i].Base, Ranges[i].End - Ranges[i].Base));
+    }
+
+cleanup:
+    if (Ranges != NULL) {
+        FreePool(Ranges);
+    }
+
+    return Status;
+}
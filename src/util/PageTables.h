@@ -0,0 +1,19 @@
+#pragma once
+
+#include <Uefi.h>
+
+// Where the higher half direct map of the physical memory usually starts,
+// with 4-level paging
+#define HIGHER_HALF_OFFSET 0xFFFF800000000000ull
+
+// Creates an empty set of 4-level page tables, the tables are allocated as
+// loader data so they outlive boot services
+EFI_STATUS CreatePageTables(UINT64** Pml4);
+
+// Maps the range with the biggest pages its alignment allows, all of it is
+// writable and executable
+EFI_STATUS MapPages(UINT64* Pml4, UINT64 Virtual, UINT64 Physical, UINT64 Size);
+
+// Maps the first 4GB and every range of the memory map above it, along with
+// the framebuffer which isn't always in the memory map, at Offset
+EFI_STATUS MapPhysicalMemory(UINT64* Pml4, UINT64 Offset);
@@ -0,0 +1,53 @@
+#include "RasterUtils.h"
+
+#include <Uefi.h>
+
+typedef UINT32 UINT32x4 __attribute__((vector_size(16)));
+
+void FillSpan32(UINT32* Dst, UINTN Count, UINT32 Color, BOOLEAN NonTemporal) {
+    // Get to a 16 byte boundary for the vector stores
+    while (Count > 0 && ((UINTN)Dst & (sizeof(UINT32x4) - 1)) != 0) {
+        *Dst++ = Color;
+        --Count;
+    }
+
+    UINT32x4 Vec = {Color, Color, Color, Color};
+    UINT32x4* VecDst = (UINT32x4*)Dst;
+    UINTN VecCount = Count / 4;
+
+    if (NonTemporal) {
+        for (UINTN i = 0; i < VecCount; ++i) {
+            __builtin_nontemporal_store(Vec, &VecDst[i]);
+        }
+    } else {
+        for (UINTN i = 0; i < VecCount; ++i) {
+            VecDst[i] = Vec;
+        }
+    }
+
+    // And whatever is left over
+    Dst += VecCount * 4;
+    for (UINTN i = 0; i < Count % 4; ++i) {
+        Dst[i] = Color;
+    }
+}
+
+void FillRect32(UINT32* Surface, UINTN Pitch, UINTN X, UINTN Y, UINTN Width, UINTN Height, UINT32 Color, BOOLEAN NonTemporal) {
+    if (Width == 0 || Height == 0) {
+        return;
+    }
+
+    if (Width == Pitch && X == 0) {
+        // Contiguous, do it in one go
+        FillSpan32(Surface + Y * Pitch, Width * Height, Color, NonTemporal);
+    } else {
+        for (UINTN Row = Y; Row < Y + Height; ++Row) {
+            FillSpan32(Surface + Row * Pitch + X, Width, Color, NonTemporal);
+        }
+    }
+
+    if (NonTemporal) {
+        // Make sure the streaming stores are visible before anyone else looks
+        __asm__ __volatile__("sfence" ::: "memory");
+    }
+}
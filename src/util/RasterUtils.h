@@ -0,0 +1,10 @@
+#pragma once
+
+#include <Uefi.h>
+
+// Fills Count 32bpp pixels starting at Dst. Non-temporal stores bypass the
+// cache, which is what we want for write-combined framebuffer memory
+void FillSpan32(UINT32* Dst, UINTN Count, UINT32 Color, BOOLEAN NonTemporal);
+
+// Fills a rectangle of a 32bpp surface row by row, Pitch is in pixels
+void FillRect32(UINT32* Surface, UINTN Pitch, UINTN X, UINTN Y, UINTN Width, UINTN Height, UINT32 Color, BOOLEAN NonTemporal);
@@ -0,0 +1,198 @@
+#include "Sha256.h"
+
+#include <Library/BaseMemoryLib.h>
+
+typedef int INT32x4 __attribute__((vector_size(16)));
+typedef int INT32x4U __attribute__((vector_size(16), aligned(1)));
+typedef char INT8x16 __attribute__((vector_size(16)));
+
+static const UINT32 K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static VOID Sha256BlocksGeneric(UINT32* State, const UINT8* Data, UINTN Blocks) {
+    for (; Blocks != 0; --Blocks, Data += SHA256_BLOCK_SIZE) {
+        UINT32 W[64];
+        for (UINTN i = 0; i < 16; ++i) {
+            W[i] = ((UINT32)Data[i * 4] << 24) | ((UINT32)Data[i * 4 + 1] << 16) | ((UINT32)Data[i * 4 + 2] << 8) | Data[i * 4 + 3];
+        }
+        for (UINTN i = 16; i < 64; ++i) {
+            UINT32 S0 = ROTR(W[i - 15], 7) ^ ROTR(W[i - 15], 18) ^ (W[i - 15] >> 3);
+            UINT32 S1 = ROTR(W[i - 2], 17) ^ ROTR(W[i - 2], 19) ^ (W[i - 2] >> 10);
+            W[i] = W[i - 16] + S0 + W[i - 7] + S1;
+        }
+
+        UINT32 A = State[0], B = State[1], C = State[2], D = State[3];
+        UINT32 E = State[4], F = State[5], G = State[6], H = State[7];
+        for (UINTN i = 0; i < 64; ++i) {
+            UINT32 T1 = H + (ROTR(E, 6) ^ ROTR(E, 11) ^ ROTR(E, 25)) + ((E & F) ^ (~E & G)) + K[i] + W[i];
+            UINT32 T2 = (ROTR(A, 2) ^ ROTR(A, 13) ^ ROTR(A, 22)) + ((A & B) ^ (A & C) ^ (B & C));
+            H = G;
+            G = F;
+            F = E;
+            E = D + T1;
+            D = C;
+            C = B;
+            B = A;
+            A = T1 + T2;
+        }
+
+        State[0] += A;
+        State[1] += B;
+        State[2] += C;
+        State[3] += D;
+        State[4] += E;
+        State[5] += F;
+        State[6] += G;
+        State[7] += H;
+    }
+}
+
+// The SHA extensions do two rounds per instruction and take care of the
+// message schedule, the state is kept as ABEF/CDGH as the instructions want it
+__attribute__((target("sha,ssse3"))) static VOID Sha256BlocksShaNi(UINT32* State, const UINT8* Data, UINTN Blocks) {
+    INT32x4 Tmp = __builtin_shufflevector(*(INT32x4U*)&State[0], *(INT32x4U*)&State[0], 1, 0, 3, 2); // CDAB
+    INT32x4 State1 = __builtin_shufflevector(*(INT32x4U*)&State[4], *(INT32x4U*)&State[4], 3, 2, 1, 0); // EFGH
+    INT32x4 State0 = __builtin_shufflevector(State1, Tmp, 2, 3, 4, 5); // ABEF
+    State1 = __builtin_shufflevector(State1, Tmp, 0, 1, 6, 7); // CDGH
+
+    for (; Blocks != 0; --Blocks, Data += SHA256_BLOCK_SIZE) {
+        INT32x4 SavedState0 = State0;
+        INT32x4 SavedState1 = State1;
+        INT32x4 W[4];
+
+        for (UINTN i = 0; i < 16; ++i) {
+            INT32x4 Msg;
+            if (i < 4) {
+                // The message words are big endian
+                INT8x16 Bytes = (INT8x16) * (INT32x4U*)(Data + i * 16);
+                Msg = (INT32x4)__builtin_shufflevector(Bytes, Bytes, 3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+            } else {
+                INT32x4 Prev1 = W[(i - 1) % 4];
+                INT32x4 Prev2 = W[(i - 2) % 4];
+                Msg = __builtin_ia32_sha256msg1(W[i % 4], W[(i - 3) % 4]);
+                Msg += __builtin_shufflevector(Prev2, Prev1, 1, 2, 3, 4);
+                Msg = __builtin_ia32_sha256msg2(Msg, Prev1);
+            }
+            W[i % 4] = Msg;
+
+            Msg += *(INT32x4U*)&K[i * 4];
+            State1 = __builtin_ia32_sha256rnds2(State1, State0, Msg);
+            Msg = __builtin_shufflevector(Msg, Msg, 2, 3, 0, 0);
+            State0 = __builtin_ia32_sha256rnds2(State0, State1, Msg);
+        }
+
+        State0 += SavedState0;
+        State1 += SavedState1;
+    }
+
+    Tmp = __builtin_shufflevector(State0, State0, 3, 2, 1, 0); // FEBA
+    State1 = __builtin_shufflevector(State1, State1, 1, 0, 3, 2); // DCHG
+    *(INT32x4U*)&State[0] = __builtin_shufflevector(Tmp, State1, 0, 1, 6, 7); // DCBA
+    *(INT32x4U*)&State[4] = __builtin_shufflevector(Tmp, State1, 2, 3, 4, 5); // HGFE
+}
+
+static VOID Cpuid(UINT32 Leaf, UINT32 SubLeaf, UINT32* Eax, UINT32* Ebx, UINT32* Ecx, UINT32* Edx) {
+    __asm__ __volatile__("cpuid"
+                         : "=a"(*Eax), "=b"(*Ebx), "=c"(*Ecx), "=d"(*Edx)
+                         : "a"(Leaf), "c"(SubLeaf));
+}
+
+typedef VOID (*SHA256_BLOCKS)(UINT32* State, const UINT8* Data, UINTN Blocks);
+
+static SHA256_BLOCKS GetBlockFunction(VOID) {
+    static SHA256_BLOCKS Blocks = NULL;
+
+    if (Blocks == NULL) {
+        UINT32 Eax, Ebx, Ecx, Edx;
+        BOOLEAN HasSha = FALSE;
+
+        Cpuid(0, 0, &Eax, &Ebx, &Ecx, &Edx);
+        if (Eax >= 7) {
+            Cpuid(1, 0, &Eax, &Ebx, &Ecx, &Edx);
+            BOOLEAN HasSsse3 = (Ecx & BIT9) != 0;
+            Cpuid(7, 0, &Eax, &Ebx, &Ecx, &Edx);
+            HasSha = HasSsse3 && (Ebx & BIT29) != 0;
+        }
+
+        Blocks = HasSha ? Sha256BlocksShaNi : Sha256BlocksGeneric;
+    }
+
+    return Blocks;
+}
+
+VOID Sha256Init(SHA256_CONTEXT* Context) {
+    static const UINT32 InitialState[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+
+    CopyMem(Context->State, InitialState, sizeof(InitialState));
+    Context->Length = 0;
+    Context->BufferSize = 0;
+}
+
+VOID Sha256Update(SHA256_CONTEXT* Context, const VOID* Data, UINTN Size) {
+    SHA256_BLOCKS Blocks = GetBlockFunction();
+    const UINT8* Bytes = Data;
+
+    Context->Length += Size;
+
+    // Finish a block left over from the last update
+    if (Context->BufferSize != 0) {
+        UINTN Copy = MIN(Size, SHA256_BLOCK_SIZE - Context->BufferSize);
+        CopyMem(Context->Buffer + Context->BufferSize, Bytes, Copy);
+        Context->BufferSize += Copy;
+        Bytes += Copy;
+        Size -= Copy;
+
+        if (Context->BufferSize < SHA256_BLOCK_SIZE) {
+            return;
+        }
+        Blocks(Context->State, Context->Buffer, 1);
+        Context->BufferSize = 0;
+    }
+
+    // Hash the whole blocks straight from the data
+    if (Size >= SHA256_BLOCK_SIZE) {
+        Blocks(Context->State, Bytes, Size / SHA256_BLOCK_SIZE);
+        Bytes += Size & ~(UINTN)(SHA256_BLOCK_SIZE - 1);
+        Size &= SHA256_BLOCK_SIZE - 1;
+    }
+
+    CopyMem(Context->Buffer, Bytes, Size);
+    Context->BufferSize = Size;
+}
+
+VOID Sha256Final(SHA256_CONTEXT* Context, UINT8 Digest[SHA256_DIGEST_SIZE]) {
+    SHA256_BLOCKS Blocks = GetBlockFunction();
+    UINT64 BitLength = Context->Length * 8;
+
+    // Pad with a one bit, zeroes and then the length in bits
+    Context->Buffer[Context->BufferSize++] = 0x80;
+    if (Context->BufferSize > SHA256_BLOCK_SIZE - 8) {
+        ZeroMem(Context->Buffer + Context->BufferSize, SHA256_BLOCK_SIZE - Context->BufferSize);
+        Blocks(Context->State, Context->Buffer, 1);
+        Context->BufferSize = 0;
+    }
+    ZeroMem(Context->Buffer + Context->BufferSize, SHA256_BLOCK_SIZE - 8 - Context->BufferSize);
+    for (UINTN i = 0; i < 8; ++i) {
+        Context->Buffer[SHA256_BLOCK_SIZE - 1 - i] = (UINT8)(BitLength >> (i * 8));
+    }
+    Blocks(Context->State, Context->Buffer, 1);
+
+    for (UINTN i = 0; i < 8; ++i) {
+        Digest[i * 4] = (UINT8)(Context->State[i] >> 24);
+        Digest[i * 4 + 1] = (UINT8)(Context->State[i] >> 16);
+        Digest[i * 4 + 2] = (UINT8)(Context->State[i] >> 8);
+        Digest[i * 4 + 3] = (UINT8)Context->State[i];
+    }
+}
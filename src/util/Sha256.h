@@ -0,0 +1,21 @@
+#pragma once
+
+#include <Uefi.h>
+
+#define SHA256_DIGEST_SIZE 32
+#define SHA256_BLOCK_SIZE 64
+
+typedef struct {
+    UINT32 State[8];
+    UINT64 Length;
+    UINT8 Buffer[SHA256_BLOCK_SIZE];
+    UINTN BufferSize;
+} SHA256_CONTEXT;
+
+VOID Sha256Init(SHA256_CONTEXT* Context);
+
+// Can be fed data in chunks of any size, only whole blocks are hashed right
+// away and the rest is buffered
+VOID Sha256Update(SHA256_CONTEXT* Context, const VOID* Data, UINTN Size);
+
+VOID Sha256Final(SHA256_CONTEXT* Context, UINT8 Digest[SHA256_DIGEST_SIZE]);
@@ -0,0 +1,494 @@
+#include "TftpFs.h"
+#include "Except.h"
+#include "MemTrack.h"
+
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+
+#include <Guid/FileInfo.h>
+#include <Protocol/Ip4Config2.h>
+#include <Protocol/Mtftp4.h>
+#include <Protocol/ServiceBinding.h>
+#include <Protocol/SimpleNetwork.h>
+
+// The largest block that fits an ethernet frame without fragmenting, and as
+// many blocks per acknowledgement as the server is willing to do (RFC 7440)
+#define TFTP_BLOCK_SIZE "1468"
+#define TFTP_WINDOW_SIZE "32"
+
+// How long we give DHCP to come up with an address
+#define DHCP_TIMEOUT_MS 10000
+#define DHCP_POLL_MS 100
+
+typedef struct TFTP_VOLUME {
+    EFI_SIMPLE_FILE_SYSTEM_PROTOCOL Fs;
+    EFI_FILE_PROTOCOL Root;
+    EFI_IPv4_ADDRESS Server;
+    EFI_MTFTP4_PROTOCOL* Mtftp;
+    struct TFTP_VOLUME* Next;
+} TFTP_VOLUME;
+
+typedef struct {
+    EFI_FILE_PROTOCOL File;
+    TFTP_VOLUME* Volume;
+    CHAR16* Name;
+    CHAR8* Path;
+    UINT64 Size;
+    UINT64 Position;
+    UINT8* Data; // Only downloaded if the file isn't read all at once
+} TFTP_FILE;
+
+static TFTP_VOLUME* mVolumes = NULL;
+static EFI_HANDLE mNic = NULL;
+
+// Older drivers refuse to even ask for a window size
+static BOOLEAN mNoWindowSize = FALSE;
+
+static EFI_MTFTP4_OPTION mReadOptions[] = {
+    { (UINT8*)"blksize", (UINT8*)TFTP_BLOCK_SIZE },
+    { (UINT8*)"windowsize", (UINT8*)TFTP_WINDOW_SIZE },
+};
+
+static EFI_MTFTP4_OPTION mInfoOptions[] = {
+    { (UINT8*)"tsize", (UINT8*)"0" },
+};
+
+static BOOLEAN HasAddress(EFI_IP4_CONFIG2_PROTOCOL* Config) {
+    EFI_IP4_CONFIG2_INTERFACE_INFO* Info = NULL;
+    UINTN Size = 0;
+    BOOLEAN Result = FALSE;
+
+    // The route table comes right after the info, so ask for the size first
+    if (Config->GetData(Config, Ip4Config2DataTypeInterfaceInfo, &Size, NULL) != EFI_BUFFER_TOO_SMALL) {
+        goto cleanup;
+    }
+
+    Info = AllocatePool(Size);
+    if (Info == NULL || EFI_ERROR(Config->GetData(Config, Ip4Config2DataTypeInterfaceInfo, &Size, Info))) {
+        goto cleanup;
+    }
+
+    Result = *(UINT32*)&Info->StationAddress != 0;
+
+cleanup:
+    if (Info != NULL) {
+        FreePool(Info);
+    }
+
+    return Result;
+}
+
+// Switches the interface to DHCP if it has no address yet, and waits for it
+static EFI_STATUS WaitForAddress(EFI_HANDLE Nic) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    EFI_IP4_CONFIG2_PROTOCOL* Config = NULL;
+
+    EFI_CHECK(gBS->HandleProtocol(Nic, &gEfiIp4Config2ProtocolGuid, (VOID**)&Config));
+    if (HasAddress(Config)) {
+        goto cleanup;
+    }
+
+    // Fails if DHCP is already running, which is just as good
+    EFI_IP4_CONFIG2_POLICY Policy = Ip4Config2PolicyDhcp;
+    Config->SetData(Config, Ip4Config2DataTypePolicy, sizeof(Policy), &Policy);
+
+    for (UINTN Waited = 0; !HasAddress(Config); Waited += DHCP_POLL_MS) {
+        CHECK_ERROR_TRACE(Waited < DHCP_TIMEOUT_MS, EFI_NO_MAPPING, "No DHCP lease");
+        gBS->Stall(DHCP_POLL_MS * 1000);
+    }
+
+cleanup:
+    return Status;
+}
+
+// Finds the first network interface that gets an address, connecting the
+// network drivers if the firmware hasn't
+static EFI_STATUS FindNic(VOID) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    EFI_HANDLE* Handles = NULL;
+    UINTN HandleCount = 0;
+
+    if (mNic != NULL) {
+        goto cleanup;
+    }
+
+    if (EFI_ERROR(gBS->LocateHandleBuffer(ByProtocol, &gEfiMtftp4ServiceBindingProtocolGuid, NULL, &HandleCount, &Handles))) {
+        EFI_CHECK(gBS->LocateHandleBuffer(ByProtocol, &gEfiSimpleNetworkProtocolGuid, NULL, &HandleCount, &Handles));
+        for (UINTN i = 0; i < HandleCount; ++i) {
+            gBS->ConnectController(Handles[i], NULL, NULL, TRUE);
+        }
+        FreePool(Handles);
+        Handles = NULL;
+
+        EFI_CHECK(gBS->LocateHandleBuffer(ByProtocol, &gEfiMtftp4ServiceBindingProtocolGuid, NULL, &HandleCount, &Handles));
+    }
+
+    for (UINTN i = 0; i < HandleCount && mNic == NULL; ++i) {
+        if (!EFI_ERROR(WaitForAddress(Handles[i]))) {
+            mNic = Handles[i];
+        }
+    }
+    CHECK_ERROR_TRACE(mNic != NULL, EFI_NO_MAPPING, "No network interface has an address");
+
+cleanup:
+    if (Handles != NULL) {
+        FreePool(Handles);
+    }
+
+    return Status;
+}
+
+static EFI_STATUS GetFileSize(TFTP_VOLUME* Volume, CHAR8* Path, UINT64* Size) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    EFI_MTFTP4_PACKET* Packet = NULL;
+    UINT32 PacketLength = 0;
+    EFI_MTFTP4_OPTION* Options = NULL;
+    UINT32 OptionCount = 0;
+
+    EFI_CHECK(Volume->Mtftp->GetInfo(Volume->Mtftp, NULL, (UINT8*)Path, NULL, ARRAY_SIZE(mInfoOptions), mInfoOptions, &PacketLength, &Packet));
+    EFI_CHECK(Volume->Mtftp->ParseOptions(Volume->Mtftp, PacketLength, Packet, &OptionCount, &Options));
+
+    BOOLEAN Found = FALSE;
+    for (UINT32 i = 0; i < OptionCount && !Found; ++i) {
+        if (AsciiStriCmp((CHAR8*)Options[i].OptionStr, "tsize") == 0) {
+            *Size = AsciiStrDecimalToUintn((CHAR8*)Options[i].ValueStr);
+            Found = TRUE;
+        }
+    }
+    CHECK_ERROR_TRACE(Found, EFI_UNSUPPORTED, "The TFTP server doesn't report the size of `%a`", Path);
+
+cleanup:
+    if (Options != NULL) {
+        FreePool(Options);
+    }
+
+    if (Packet != NULL) {
+        FreePool(Packet);
+    }
+
+    return Status;
+}
+
+// Streams the whole file straight into the buffer
+static EFI_STATUS Download(TFTP_FILE* File, VOID* Buffer) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    EFI_MTFTP4_PROTOCOL* Mtftp = File->Volume->Mtftp;
+
+    EFI_MTFTP4_TOKEN Token = {
+        .Filename = (UINT8*)File->Path,
+        .OptionCount = mNoWindowSize ? 1 : ARRAY_SIZE(mReadOptions),
+        .OptionList = mReadOptions,
+        .BufferSize = File->Size,
+        .Buffer = Buffer,
+    };
+
+    Status = Mtftp->ReadFile(Mtftp, &Token);
+    if (Status == EFI_UNSUPPORTED && !mNoWindowSize) {
+        mNoWindowSize = TRUE;
+        Token.OptionCount = 1;
+        Status = Mtftp->ReadFile(Mtftp, &Token);
+    }
+    CHECK_ERROR_TRACE(!EFI_ERROR(Status), Status, "Could not download `%a`", File->Path);
+
+cleanup:
+    return Status;
+}
+
+static EFI_STATUS EFIAPI TftpFileClose(EFI_FILE_PROTOCOL* This) {
+    TFTP_FILE* File = BASE_CR(This, TFTP_FILE, File);
+
+    if (File->Data != NULL) {
+        TrackFree(MEM_TAG_NETWORK, EFI_PAGES_TO_SIZE(EFI_SIZE_TO_PAGES(File->Size)));
+        FreePages(File->Data, EFI_SIZE_TO_PAGES(File->Size));
+    }
+    FreePool(File->Name);
+    FreePool(File->Path);
+    FreePool(File);
+
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI TftpFileRead(EFI_FILE_PROTOCOL* This, UINTN* BufferSize, VOID* Buffer) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    TFTP_FILE* File = BASE_CR(This, TFTP_FILE, File);
+
+    UINTN Length = File->Position < File->Size ? MIN(*BufferSize, File->Size - File->Position) : 0;
+    *BufferSize = 0;
+    if (Length == 0) {
+        goto cleanup;
+    }
+
+    // Reading the whole file at once is what the loaders do unless they
+    // verify it, and then there is no need for a copy of our own
+    if (File->Data == NULL && File->Position == 0 && Length == File->Size) {
+        CHECK_AND_RETHROW(Download(File, Buffer));
+    } else {
+        if (File->Data == NULL) {
+            File->Data = AllocatePages(EFI_SIZE_TO_PAGES(File->Size));
+            CHECK_ERROR(File->Data != NULL, EFI_OUT_OF_RESOURCES);
+            TrackAllocation(MEM_TAG_NETWORK, EFI_PAGES_TO_SIZE(EFI_SIZE_TO_PAGES(File->Size)));
+            Status = Download(File, File->Data);
+            if (EFI_ERROR(Status)) {
+                TrackFree(MEM_TAG_NETWORK, EFI_PAGES_TO_SIZE(EFI_SIZE_TO_PAGES(File->Size)));
+                FreePages(File->Data, EFI_SIZE_TO_PAGES(File->Size));
+                File->Data = NULL;
+                goto cleanup;
+            }
+        }
+        CopyMem(Buffer, File->Data + File->Position, Length);
+    }
+
+    File->Position += Length;
+    *BufferSize = Length;
+
+cleanup:
+    return Status;
+}
+
+static EFI_STATUS EFIAPI TftpFileGetPosition(EFI_FILE_PROTOCOL* This, UINT64* Position) {
+    *Position = BASE_CR(This, TFTP_FILE, File)->Position;
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI TftpFileSetPosition(EFI_FILE_PROTOCOL* This, UINT64 Position) {
+    TFTP_FILE* File = BASE_CR(This, TFTP_FILE, File);
+
+    // All ones asks for the end of the file
+    File->Position = Position == MAX_UINT64 ? File->Size : Position;
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI TftpFileGetInfo(EFI_FILE_PROTOCOL* This, EFI_GUID* InformationType, UINTN* BufferSize, VOID* Buffer) {
+    TFTP_FILE* File = BASE_CR(This, TFTP_FILE, File);
+
+    if (!CompareGuid(InformationType, &gEfiFileInfoGuid)) {
+        return EFI_UNSUPPORTED;
+    }
+
+    UINTN Size = SIZE_OF_EFI_FILE_INFO + StrSize(File->Name);
+    if (*BufferSize < Size) {
+        *BufferSize = Size;
+        return EFI_BUFFER_TOO_SMALL;
+    }
+
+    EFI_FILE_INFO* Info = Buffer;
+    ZeroMem(Info, Size);
+    Info->Size = Size;
+    Info->FileSize = File->Size;
+    Info->PhysicalSize = File->Size;
+    Info->Attribute = EFI_FILE_READ_ONLY;
+    CopyMem(Info->FileName, File->Name, StrSize(File->Name));
+    *BufferSize = Size;
+
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI TftpFileWrite(EFI_FILE_PROTOCOL* This, UINTN* BufferSize, VOID* Buffer) {
+    (VOID)This;
+    (VOID)BufferSize;
+    (VOID)Buffer;
+
+    return EFI_WRITE_PROTECTED;
+}
+
+static EFI_STATUS EFIAPI TftpFileDelete(EFI_FILE_PROTOCOL* This) {
+    This->Close(This);
+    return EFI_WARN_DELETE_FAILURE;
+}
+
+static EFI_STATUS EFIAPI TftpFileSetInfo(EFI_FILE_PROTOCOL* This, EFI_GUID* InformationType, UINTN BufferSize, VOID* Buffer) {
+    (VOID)This;
+    (VOID)InformationType;
+    (VOID)BufferSize;
+    (VOID)Buffer;
+
+    return EFI_WRITE_PROTECTED;
+}
+
+static EFI_STATUS EFIAPI TftpFileFlush(EFI_FILE_PROTOCOL* This) {
+    (VOID)This;
+
+    return EFI_SUCCESS;
+}
+
+// There are no directories, files can only be opened from the root
+static EFI_STATUS EFIAPI TftpFileOpen(EFI_FILE_PROTOCOL* This, EFI_FILE_PROTOCOL** NewHandle, CHAR16* FileName, UINT64 OpenMode, UINT64 Attributes) {
+    (VOID)This;
+    (VOID)NewHandle;
+    (VOID)FileName;
+    (VOID)OpenMode;
+    (VOID)Attributes;
+
+    return EFI_UNSUPPORTED;
+}
+
+static const EFI_FILE_PROTOCOL mTftpFileProtocol = {
+    .Revision = EFI_FILE_PROTOCOL_REVISION,
+    .Open = TftpFileOpen,
+    .Close = TftpFileClose,
+    .Delete = TftpFileDelete,
+    .Read = TftpFileRead,
+    .Write = TftpFileWrite,
+    .GetPosition = TftpFileGetPosition,
+    .SetPosition = TftpFileSetPosition,
+    .GetInfo = TftpFileGetInfo,
+    .SetInfo = TftpFileSetInfo,
+    .Flush = TftpFileFlush,
+};
+
+// Every path is taken from the root of the server
+static EFI_STATUS EFIAPI TftpRootOpen(EFI_FILE_PROTOCOL* This, EFI_FILE_PROTOCOL** NewHandle, CHAR16* FileName, UINT64 OpenMode, UINT64 Attributes) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    TFTP_VOLUME* Volume = BASE_CR(This, TFTP_VOLUME, Root);
+    TFTP_FILE* File = NULL;
+    (VOID)Attributes;
+
+    CHECK_ERROR(OpenMode == EFI_FILE_MODE_READ, EFI_WRITE_PROTECTED);
+
+    File = AllocateZeroPool(sizeof(TFTP_FILE));
+    CHECK_ERROR(File != NULL, EFI_OUT_OF_RESOURCES);
+    CopyMem(&File->File, &mTftpFileProtocol, sizeof(EFI_FILE_PROTOCOL));
+    File->Volume = Volume;
+
+    while (*FileName == L'\\') {
+        FileName++;
+    }
+    File->Name = AllocateCopyPool(StrSize(FileName), FileName);
+    File->Path = AllocatePool(StrLen(FileName) + 1);
+    CHECK_ERROR(File->Name != NULL && File->Path != NULL, EFI_OUT_OF_RESOURCES);
+
+    // The paths in the config were turned into UEFI ones
+    EFI_CHECK(UnicodeStrToAsciiStrS(FileName, File->Path, StrLen(FileName) + 1));
+    for (CHAR8* C = File->Path; *C != '\0'; C++) {
+        if (*C == '\\') {
+            *C = '/';
+        }
+    }
+
+    CHECK_AND_RETHROW(GetFileSize(Volume, File->Path, &File->Size));
+    *NewHandle = &File->File;
+
+cleanup:
+    if (EFI_ERROR(Status) && File != NULL) {
+        if (File->Name != NULL) {
+            FreePool(File->Name);
+        }
+        if (File->Path != NULL) {
+            FreePool(File->Path);
+        }
+        FreePool(File);
+    }
+
+    return Status;
+}
+
+static EFI_STATUS EFIAPI TftpRootClose(EFI_FILE_PROTOCOL* This) {
+    (VOID)This;
+
+    return EFI_SUCCESS;
+}
+
+// The root can't be listed
+static EFI_STATUS EFIAPI TftpRootRead(EFI_FILE_PROTOCOL* This, UINTN* BufferSize, VOID* Buffer) {
+    (VOID)This;
+    (VOID)BufferSize;
+    (VOID)Buffer;
+
+    return EFI_UNSUPPORTED;
+}
+
+static EFI_STATUS EFIAPI TftpRootGetPosition(EFI_FILE_PROTOCOL* This, UINT64* Position) {
+    (VOID)This;
+    (VOID)Position;
+
+    return EFI_UNSUPPORTED;
+}
+
+static EFI_STATUS EFIAPI TftpRootSetPosition(EFI_FILE_PROTOCOL* This, UINT64 Position) {
+    (VOID)This;
+    (VOID)Position;
+
+    return EFI_UNSUPPORTED;
+}
+
+static EFI_STATUS EFIAPI TftpRootGetInfo(EFI_FILE_PROTOCOL* This, EFI_GUID* InformationType, UINTN* BufferSize, VOID* Buffer) {
+    (VOID)This;
+    (VOID)InformationType;
+    (VOID)BufferSize;
+    (VOID)Buffer;
+
+    return EFI_UNSUPPORTED;
+}
+
+static const EFI_FILE_PROTOCOL mTftpRootProtocol = {
+    .Revision = EFI_FILE_PROTOCOL_REVISION,
+    .Open = TftpRootOpen,
+    .Close = TftpRootClose,
+    .Delete = TftpFileDelete,
+    .Read = TftpRootRead,
+    .Write = TftpFileWrite,
+    .GetPosition = TftpRootGetPosition,
+    .SetPosition = TftpRootSetPosition,
+    .GetInfo = TftpRootGetInfo,
+    .SetInfo = TftpFileSetInfo,
+    .Flush = TftpFileFlush,
+};
+
+static EFI_STATUS EFIAPI TftpOpenVolume(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* This, EFI_FILE_PROTOCOL** Root) {
+    *Root = &BASE_CR(This, TFTP_VOLUME, Fs)->Root;
+    return EFI_SUCCESS;
+}
+
+EFI_STATUS OpenTftpVolume(EFI_IPv4_ADDRESS* Server, EFI_SIMPLE_FILE_SYSTEM_PROTOCOL** Fs) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    TFTP_VOLUME* Volume = NULL;
+    EFI_SERVICE_BINDING_PROTOCOL* ServiceBinding = NULL;
+    EFI_HANDLE Child = NULL;
+
+    for (Volume = mVolumes; Volume != NULL; Volume = Volume->Next) {
+        if (CompareMem(&Volume->Server, Server, sizeof(EFI_IPv4_ADDRESS)) == 0) {
+            *Fs = &Volume->Fs;
+            goto cleanup;
+        }
+    }
+
+    CHECK_AND_RETHROW(FindNic());
+
+    Volume = AllocateZeroPool(sizeof(TFTP_VOLUME));
+    CHECK_ERROR(Volume != NULL, EFI_OUT_OF_RESOURCES);
+    Volume->Fs.Revision = EFI_SIMPLE_FILE_SYSTEM_PROTOCOL_REVISION;
+    Volume->Fs.OpenVolume = TftpOpenVolume;
+    CopyMem(&Volume->Root, &mTftpRootProtocol, sizeof(EFI_FILE_PROTOCOL));
+    CopyMem(&Volume->Server, Server, sizeof(EFI_IPv4_ADDRESS));
+
+    EFI_CHECK(gBS->HandleProtocol(mNic, &gEfiMtftp4ServiceBindingProtocolGuid, (VOID**)&ServiceBinding));
+    EFI_CHECK(ServiceBinding->CreateChild(ServiceBinding, &Child));
+    EFI_CHECK(gBS->HandleProtocol(Child, &gEfiMtftp4ProtocolGuid, (VOID**)&Volume->Mtftp));
+
+    EFI_MTFTP4_CONFIG_DATA Config = {
+        .UseDefaultSetting = TRUE,
+        .InitialServerPort = 69,
+        .TryCount = 4,
+        .TimeoutValue = 2,
+    };
+    CopyMem(&Config.ServerIp, Server, sizeof(EFI_IPv4_ADDRESS));
+    EFI_CHECK(Volume->Mtftp->Configure(Volume->Mtftp, &Config));
+
+    Volume->Next = mVolumes;
+    mVolumes = Volume;
+    *Fs = &Volume->Fs;
+
+cleanup:
+    if (EFI_ERROR(Status)) {
+        if (Child != NULL) {
+            ServiceBinding->DestroyChild(ServiceBinding, Child);
+        }
+        if (Volume != NULL) {
+            FreePool(Volume);
+        }
+    }
+
+    return Status;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <Uefi.h>
+
+#include <Protocol/SimpleFileSystem.h>
+
+// Makes the files on a TFTP server look like a read-only filesystem, so the
+// loaders can read from it like from any other volume. The network is brought
+// up on first use, with DHCP if the interface has no address yet. Volumes are
+// kept around, so this is cheap to call again for the same server.
+EFI_STATUS OpenTftpVolume(EFI_IPv4_ADDRESS* Server, EFI_SIMPLE_FILE_SYSTEM_PROTOCOL** Fs);
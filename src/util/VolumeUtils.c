@@ -0,0 +1,102 @@
+#include "VolumeUtils.h"
+#include "DPUtils.h"
+#include "Except.h"
+
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+
+#include <Protocol/LoadedImage.h>
+
+static VOLUME* mVolumes = NULL;
+static UINTN mVolumeCount = 0;
+static EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* mBootVolume = NULL;
+
+EFI_STATUS BuildVolumeIndex(VOID) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    EFI_LOADED_IMAGE_PROTOCOL* LoadedImage = NULL;
+    EFI_DEVICE_PATH* ImageDevicePath = NULL;
+    EFI_DEVICE_PATH* BootDrivePath = NULL;
+    EFI_HANDLE* Handles = NULL;
+    UINTN HandleCount = 0;
+    EFI_HANDLE FsHandle = NULL;
+
+    CHECK(mVolumes == NULL);
+
+    // Get the boot image device path
+    EFI_CHECK(gBS->HandleProtocol(gImageHandle, &gEfiLoadedImageProtocolGuid, (void**)&LoadedImage));
+    EFI_CHECK(gBS->HandleProtocol(LoadedImage->DeviceHandle, &gEfiDevicePathProtocolGuid, (void**)&ImageDevicePath));
+
+    // remove the last part which should be the partition itself, so we can
+    // tell which filesystems are on the same drive
+    BootDrivePath = RemoveLastDevicePathNode(ImageDevicePath);
+    CHECK(BootDrivePath != NULL);
+
+    // Locate the boot file system
+    EFI_DEVICE_PATH* RemainingPath = ImageDevicePath;
+    EFI_CHECK(gBS->LocateDevicePath(&gEfiSimpleFileSystemProtocolGuid, &RemainingPath, &FsHandle));
+    EFI_CHECK(gBS->HandleProtocol(FsHandle, &gEfiSimpleFileSystemProtocolGuid, (void**)&mBootVolume));
+
+    EFI_CHECK(gBS->LocateHandleBuffer(ByProtocol, &gEfiSimpleFileSystemProtocolGuid, NULL, &HandleCount, &Handles));
+    mVolumes = AllocateZeroPool(HandleCount * sizeof(VOLUME));
+    CHECK_ERROR(mVolumes != NULL, EFI_OUT_OF_RESOURCES);
+
+    for (UINTN i = 0; i < HandleCount; ++i) {
+        VOLUME* Volume = &mVolumes[mVolumeCount];
+        EFI_DEVICE_PATH* DevicePath = NULL;
+
+        EFI_CHECK(gBS->HandleProtocol(Handles[i], &gEfiSimpleFileSystemProtocolGuid, (void**)&Volume->Fs));
+        if (EFI_ERROR(gBS->HandleProtocol(Handles[i], &gEfiDevicePathProtocolGuid, (void**)&DevicePath))) {
+            continue;
+        }
+        mVolumeCount++;
+
+        Volume->OnBootDrive = InsideDevicePath(DevicePath, BootDrivePath);
+
+        // Only partitions can be looked up
+        DevicePath = LastDevicePathNode(DevicePath);
+        if (DevicePath == NULL || DevicePathType(DevicePath) != MEDIA_DEVICE_PATH || DevicePathSubType(DevicePath) != MEDIA_HARDDRIVE_DP) {
+            continue;
+        }
+
+        HARDDRIVE_DEVICE_PATH* Hd = (HARDDRIVE_DEVICE_PATH*)DevicePath;
+        Volume->PartitionNumber = Hd->PartitionNumber;
+        if (Hd->SignatureType == SIGNATURE_TYPE_GUID) {
+            Volume->HasGuid = TRUE;
+            CopyGuid(&Volume->Guid, (EFI_GUID*)Hd->Signature);
+        }
+    }
+
+cleanup:
+    if (Handles != NULL) {
+        FreePool(Handles);
+    }
+
+    if (BootDrivePath != NULL) {
+        FreePool(BootDrivePath);
+    }
+
+    return Status;
+}
+
+EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* GetBootVolume(VOID) {
+    return mBootVolume;
+}
+
+EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* FindBootDrivePartition(UINT32 PartitionNumber) {
+    for (UINTN i = 0; i < mVolumeCount; ++i) {
+        if (mVolumes[i].OnBootDrive && mVolumes[i].PartitionNumber != 0 && mVolumes[i].PartitionNumber == PartitionNumber) {
+            return mVolumes[i].Fs;
+        }
+    }
+    return NULL;
+}
+
+EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* FindPartitionByGuid(EFI_GUID* Guid) {
+    for (UINTN i = 0; i < mVolumeCount; ++i) {
+        if (mVolumes[i].HasGuid && CompareGuid(&mVolumes[i].Guid, Guid)) {
+            return mVolumes[i].Fs;
+        }
+    }
+    return NULL;
+}
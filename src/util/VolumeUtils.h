@@ -0,0 +1,24 @@
+#pragma once
+
+#include <Uefi.h>
+
+#include <Protocol/SimpleFileSystem.h>
+
+typedef struct {
+    EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* Fs;
+    BOOLEAN OnBootDrive;
+    UINT32 PartitionNumber; // Zero if this is not a partition
+    BOOLEAN HasGuid;
+    EFI_GUID Guid;
+} VOLUME;
+
+// Walks all the filesystems once, after this they can be looked up without
+// going through the firmware
+EFI_STATUS BuildVolumeIndex(VOID);
+
+// The filesystem RainLoader was started from
+EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* GetBootVolume(VOID);
+
+// Returns NULL if there is no such volume
+EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* FindBootDrivePartition(UINT32 PartitionNumber);
+EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* FindPartitionByGuid(EFI_GUID* Guid);
@@ -0,0 +1,208 @@
+#include "WorkPool.h"
+#include "Except.h"
+#include "MemTrack.h"
+
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+
+#include <Protocol/MpService.h>
+
+// Every worker owns a range of the indices, packed as End << 32 | Begin so
+// that it can be updated with a single compare exchange. Workers take from
+// the front of their own range, and once it runs dry they steal the back
+// half of someone else's.
+typedef struct {
+    UINT64 Range;
+    UINT8 Padding[56]; // One worker per cache line
+} WORKER;
+
+#define RANGE(Begin, End) (((UINT64)(End) << 32) | (UINT32)(Begin))
+#define RANGE_BEGIN(Range) ((UINT32)(Range))
+#define RANGE_END(Range) ((UINT32)((Range) >> 32))
+
+// Splitting anything smaller isn't worth waking up the other processors
+#define PARALLEL_CHUNK_SIZE SIZE_1MB
+#define PARALLEL_MIN_SIZE (4 * PARALLEL_CHUNK_SIZE)
+
+static EFI_MP_SERVICES_PROTOCOL* mMpServices = NULL;
+static EFI_EVENT mApsDone = NULL;
+
+// The BSP is always worker zero
+static WORKER mBspWorker = {};
+static WORKER* mWorkers = &mBspWorker;
+static UINTN mWorkerCount = 1;
+
+// The work that is currently running
+static WORK_FUNCTION mFunction = NULL;
+static VOID* mContext = NULL;
+static UINTN mNextWorker = 0;
+static BOOLEAN mApsRunning = FALSE;
+
+EFI_STATUS InitWorkPool(VOID) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    UINTN ProcessorCount = 0;
+    UINTN EnabledCount = 0;
+    WORKER* Workers = NULL;
+
+    // Not every firmware has it, and that is fine
+    if (EFI_ERROR(gBS->LocateProtocol(&gEfiMpServiceProtocolGuid, NULL, (VOID**)&mMpServices))) {
+        mMpServices = NULL;
+        goto cleanup;
+    }
+
+    EFI_CHECK(mMpServices->GetNumberOfProcessors(mMpServices, &ProcessorCount, &EnabledCount));
+    if (EnabledCount <= 1) {
+        goto cleanup;
+    }
+
+    // Signaled once all the APs are done, so the BSP doesn't have to block
+    // in StartupAllAPs
+    EFI_CHECK(gBS->CreateEvent(0, TPL_CALLBACK, NULL, NULL, &mApsDone));
+
+    Workers = AllocatePages(EFI_SIZE_TO_PAGES(EnabledCount * sizeof(WORKER)));
+    CHECK_ERROR(Workers != NULL, EFI_OUT_OF_RESOURCES);
+    TrackAllocation(MEM_TAG_WORKERS, EFI_PAGES_TO_SIZE(EFI_SIZE_TO_PAGES(EnabledCount * sizeof(WORKER))));
+    ZeroMem(Workers, EnabledCount * sizeof(WORKER));
+
+    mWorkers = Workers;
+    mWorkerCount = EnabledCount;
+
+cleanup:
+    if (EFI_ERROR(Status)) {
+        if (mApsDone != NULL) {
+            gBS->CloseEvent(mApsDone);
+            mApsDone = NULL;
+        }
+        mMpServices = NULL;
+    }
+
+    return Status;
+}
+
+static BOOLEAN TakeIndex(WORKER* Worker, UINTN* Index) {
+    UINT64 Range = __atomic_load_n(&Worker->Range, __ATOMIC_ACQUIRE);
+    UINT64 NewRange;
+
+    do {
+        if (RANGE_BEGIN(Range) >= RANGE_END(Range)) {
+            return FALSE;
+        }
+        NewRange = RANGE(RANGE_BEGIN(Range) + 1, RANGE_END(Range));
+    } while (!__atomic_compare_exchange_n(&Worker->Range, &Range, NewRange, FALSE, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+    *Index = RANGE_BEGIN(Range);
+    return TRUE;
+}
+
+static BOOLEAN StealRange(WORKER* Victim, WORKER* Thief) {
+    UINT64 Range = __atomic_load_n(&Victim->Range, __ATOMIC_ACQUIRE);
+    UINT32 Middle;
+
+    do {
+        UINT32 Begin = RANGE_BEGIN(Range);
+        UINT32 End = RANGE_END(Range);
+        if (Begin >= End) {
+            return FALSE;
+        }
+
+        // A single index is taken as a whole
+        Middle = Begin + (End - Begin) / 2;
+    } while (!__atomic_compare_exchange_n(&Victim->Range, &Range, RANGE(RANGE_BEGIN(Range), Middle), FALSE, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+    // Our own range is empty, so nobody else touches it
+    __atomic_store_n(&Thief->Range, RANGE(Middle, RANGE_END(Range)), __ATOMIC_RELEASE);
+    return TRUE;
+}
+
+static VOID RunWorker(UINTN Self) {
+    UINTN Index;
+    BOOLEAN Stole;
+
+    do {
+        while (TakeIndex(&mWorkers[Self], &Index)) {
+            mFunction(mContext, Index);
+        }
+
+        Stole = FALSE;
+        for (UINTN i = 1; i < mWorkerCount && !Stole; ++i) {
+            Stole = StealRange(&mWorkers[(Self + i) % mWorkerCount], &mWorkers[Self]);
+        }
+    } while (Stole);
+}
+
+static VOID EFIAPI ApEntry(VOID* Buffer) {
+    (VOID)Buffer;
+
+    UINTN Self = __atomic_add_fetch(&mNextWorker, 1, __ATOMIC_ACQ_REL);
+    if (Self < mWorkerCount) {
+        RunWorker(Self);
+    }
+}
+
+VOID StartWork(WORK_FUNCTION Function, VOID* Context, UINTN Count) {
+    ASSERT(!mApsRunning);
+    ASSERT(Count <= MAX_UINT32);
+
+    mFunction = Function;
+    mContext = Context;
+    mNextWorker = 0;
+
+    // The BSP is expected to be busy with I/O, so all of the work goes to the
+    // APs and the BSP only steals once it gets to FinishWork
+    UINTN First = mWorkerCount > 1 ? 1 : 0;
+    UINTN Shares = mWorkerCount - First;
+    __atomic_store_n(&mWorkers[0].Range, 0, __ATOMIC_RELAXED);
+    for (UINTN i = First; i < mWorkerCount; ++i) {
+        UINTN Begin = Count * (i - First) / Shares;
+        UINTN End = Count * (i - First + 1) / Shares;
+        __atomic_store_n(&mWorkers[i].Range, RANGE(Begin, End), __ATOMIC_RELEASE);
+    }
+
+    // If the APs can't be started the BSP steals all of their work
+    if (mMpServices != NULL && Count != 0) {
+        mApsRunning = !EFI_ERROR(mMpServices->StartupAllAPs(mMpServices, ApEntry, FALSE, mApsDone, 0, NULL, NULL));
+    }
+}
+
+VOID FinishWork(VOID) {
+    RunWorker(0);
+
+    // Some of the APs may still be finishing up their last index
+    if (mApsRunning) {
+        UINTN Index;
+        gBS->WaitForEvent(1, &mApsDone, &Index);
+        mApsRunning = FALSE;
+    }
+}
+
+VOID RunWork(WORK_FUNCTION Function, VOID* Context, UINTN Count) {
+    StartWork(Function, Context, Count);
+    FinishWork();
+}
+
+typedef struct {
+    UINT8* Destination;
+    const UINT8* Source;
+    UINTN Length;
+} COPY_WORK;
+
+static VOID CopyChunk(VOID* Context, UINTN Index) {
+    COPY_WORK* Work = Context;
+    UINTN Offset = Index * PARALLEL_CHUNK_SIZE;
+    UINTN Length = MIN(Work->Length - Offset, PARALLEL_CHUNK_SIZE);
+
+    CopyMem(Work->Destination + Offset, Work->Source + Offset, Length);
+}
+
+VOID ParallelCopyMem(VOID* Destination, const VOID* Source, UINTN Length) {
+    if (mWorkerCount == 1 || Length < PARALLEL_MIN_SIZE) {
+        CopyMem(Destination, Source, Length);
+        return;
+    }
+
+    COPY_WORK Work = { Destination, Source, Length };
+    RunWork(CopyChunk, &Work, (Length + PARALLEL_CHUNK_SIZE - 1) / PARALLEL_CHUNK_SIZE);
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <Uefi.h>
+
+// Called once for every index of the work. It may run on any processor, so
+// it must only compute and never call into the firmware.
+typedef VOID (*WORK_FUNCTION)(VOID* Context, UINTN Index);
+
+// Finds the application processors, without them all the work simply runs
+// on the BSP
+EFI_STATUS InitWorkPool(VOID);
+
+// Hands [0, Count) to the application processors and returns right away, so
+// the BSP can do firmware I/O in the meantime. Only one piece of work can be
+// running at a time.
+VOID StartWork(WORK_FUNCTION Function, VOID* Context, UINTN Count);
+
+// The BSP helps with whatever is left and waits until all of it is done
+VOID FinishWork(VOID);
+
+// Runs the work to completion on all processors
+VOID RunWork(WORK_FUNCTION Function, VOID* Context, UINTN Count);
+
+// Same as CopyMem but large buffers are split over all the processors, the
+// buffers must not overlap
+VOID ParallelCopyMem(VOID* Destination, const VOID* Source, UINTN Length);